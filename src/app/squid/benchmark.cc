@@ -13,7 +13,7 @@ squid_benchmark(void)
         Genode::log("benchmark ", i);
 
         char* filehash = nullptr;
-        if (squid_hash((void**)&filehash) == SQUID_FULL) {
+        if (squid_hash_near((void**)&filehash, i) == SQUID_FULL) {
             Genode::error("SQUID: out of hashes: ", i);
             break;
         }
@@ -22,3 +22,858 @@ squid_benchmark(void)
             Genode::error("SQUID: write: ", i);
     }
 }
+
+static Genode::uint64_t
+acquire_hashes(void** hashes)
+{
+    Genode::uint64_t count = 0;
+
+    for (; count < SquidSnapshot::HASH_COUNT; count++) {
+        if (squid_hash_near(&hashes[count], count) != SQUID_NONE)
+            break;
+    }
+
+    if (count == 0)
+        Genode::error("SQUID: out of hashes");
+
+    return count;
+}
+
+static Genode::uint64_t
+write_pages(void** hashes, Genode::uint64_t count, char* page)
+{
+    Genode::uint64_t start =
+      SquidSnapshot::squidutils->_timer.elapsed_us();
+
+    for (Genode::uint64_t i = 0; i < 10000; i++) {
+        page[0] = (char)i;
+
+        Genode::size_t const size = SquidSnapshot::MAX_PAYLOAD_SIZE;
+        if (squid_write(hashes[i % count], page, size) != SQUID_NONE)
+            Genode::error("SQUID: write: ", i);
+    }
+
+    return SquidSnapshot::squidutils->_timer.elapsed_us() - start;
+}
+
+void
+squid_benchmark_encryption(void)
+{
+    using SquidSnapshot::squidutils;
+
+    static char page[SquidSnapshot::MAX_PAYLOAD_SIZE];
+    for (Genode::size_t i = 0; i < sizeof(page); i++)
+        page[i] = (char)(i * 31);
+
+    static void* hashes[SquidSnapshot::HASH_COUNT];
+    Genode::uint64_t count = acquire_hashes(hashes);
+    if (count == 0)
+        return;
+
+    bool const configured = squidutils->encrypted();
+    if (configured)
+        squidutils->clear_key();
+
+    Genode::uint64_t plain_us = write_pages(hashes, count, page);
+
+    Genode::uint8_t const key[SquidSnapshot::Cipher::KEY_SIZE] = {
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+        0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f
+    };
+    squidutils->set_key(key);
+
+    Genode::uint64_t encrypted_us = write_pages(hashes, count, page);
+
+    squidutils->clear_key();
+
+    Genode::uint64_t const bytes = 10000 * sizeof(page);
+    Genode::log("benchmark plaintext: ",
+                plain_us,
+                " us, ",
+                bytes / (plain_us ? plain_us : 1),
+                " MB/s");
+    Genode::log("benchmark encrypted: ",
+                encrypted_us,
+                " us, ",
+                bytes / (encrypted_us ? encrypted_us : 1),
+                " MB/s");
+
+    for (Genode::uint64_t i = 0; i < count; i++)
+        squid_delete(hashes[i]);
+
+    // INFO: Reinstall the configured key, the benchmark key must not be
+    // used for the actual snapshot.
+    if (configured)
+        squidutils->_init_encryption();
+}
+
+void
+squid_benchmark_staging(void)
+{
+    using SquidSnapshot::squidutils;
+
+    static char page[SquidSnapshot::MAX_PAYLOAD_SIZE];
+    for (Genode::size_t i = 0; i < sizeof(page); i++)
+        page[i] = (char)(i * 17);
+
+    static void* hashes[SquidSnapshot::HASH_COUNT];
+    Genode::uint64_t count = acquire_hashes(hashes);
+    if (count == 0)
+        return;
+
+    // INFO: Pages are staged in batches that fit into the ring, as the
+    // kernel would do while holding the page locks, and drained after.
+    Genode::uint64_t const batch = 256;
+    Genode::uint64_t stage_us = 0;
+    Genode::uint64_t drain_us = 0;
+
+    for (Genode::uint64_t i = 0; i < 10000; i += batch) {
+        Genode::uint64_t start = squidutils->_timer.elapsed_us();
+
+        for (Genode::uint64_t j = i; j < i + batch && j < 10000; j++) {
+            page[0] = (char)j;
+
+            if (squid_stage(hashes[j % count], page, sizeof(page)) !=
+                SQUID_NONE)
+                Genode::error("SQUID: stage: ", j);
+        }
+
+        Genode::uint64_t staged = squidutils->_timer.elapsed_us();
+
+        if (squid_drain(0) != SQUID_NONE)
+            Genode::error("SQUID: drain: ", i);
+
+        stage_us += staged - start;
+        drain_us += squidutils->_timer.elapsed_us() - staged;
+    }
+
+    struct SquidStats stats;
+    squid_stats(&stats);
+
+    Genode::log("benchmark staging: ",
+                stage_us,
+                " us locked, ",
+                drain_us,
+                " us draining");
+    Genode::log("benchmark staging: high water ",
+                stats.staging_high_water,
+                " of ",
+                stats.staging_capacity,
+                " bytes, drain rate ",
+                stats.drain_rate / 1000000,
+                " MB/s, ",
+                stats.staging_overflows,
+                " overflows");
+
+    for (Genode::uint64_t i = 0; i < count; i++)
+        squid_delete(hashes[i]);
+}
+
+static Genode::uint64_t
+submit_pages(SquidSnapshot::ParallelWriter& writer,
+             void** hashes,
+             Genode::uint64_t count,
+             char* page)
+{
+    Genode::uint64_t start =
+      SquidSnapshot::squidutils->_timer.elapsed_us();
+
+    for (Genode::uint64_t i = 0; i < 10000; i++) {
+        SquidSnapshot::SquidFileHash* hash =
+          (SquidSnapshot::SquidFileHash*)hashes[i % count];
+
+        if (writer.submit(hash, page, SquidSnapshot::MAX_PAYLOAD_SIZE) !=
+            SquidSnapshot::Error::None)
+            Genode::error("SQUID: submit: ", i);
+    }
+
+    if (writer.join() != SquidSnapshot::Error::None)
+        Genode::error("SQUID: join");
+
+    return SquidSnapshot::squidutils->_timer.elapsed_us() - start;
+}
+
+void
+squid_benchmark_parallel(void)
+{
+    using SquidSnapshot::squidutils;
+
+    static char page[SquidSnapshot::MAX_PAYLOAD_SIZE];
+    for (Genode::size_t i = 0; i < sizeof(page); i++)
+        page[i] = (char)(i * 13);
+
+    static void* hashes[SquidSnapshot::HASH_COUNT];
+    Genode::uint64_t count = acquire_hashes(hashes);
+    if (count == 0)
+        return;
+
+    bool const configured = squidutils->encrypted();
+
+    // INFO: Encryption is what the workers spend their time on.
+    Genode::uint8_t const key[SquidSnapshot::Cipher::KEY_SIZE] = {
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+        0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f
+    };
+    squidutils->set_key(key);
+
+    unsigned const cpus = squidutils->_backend.cpu_count();
+    Genode::uint64_t const bytes = 10000 * sizeof(page);
+
+    for (unsigned workers = 1; workers <= 4; workers *= 2) {
+        if (workers > cpus && workers > 1)
+            break;
+
+        SquidSnapshot::ParallelWriter::Config config{
+            workers, 0, 1024 * 1024
+        };
+        SquidSnapshot::ParallelWriter writer(squidutils->_backend, config);
+
+        Genode::uint64_t us = submit_pages(writer, hashes, count, page);
+
+        SquidSnapshot::ParallelWriter::Stats const& stats =
+          writer.statistics();
+
+        Genode::log("benchmark parallel: ",
+                    workers,
+                    " workers, ",
+                    us,
+                    " us, ",
+                    bytes / (us ? us : 1),
+                    " MB/s, ",
+                    stats.prepare_us,
+                    " us in the workers, ",
+                    stats.write_us,
+                    " us writing serially");
+    }
+
+    squidutils->clear_key();
+
+    for (Genode::uint64_t i = 0; i < count; i++)
+        squid_delete(hashes[i]);
+
+    if (configured)
+        squidutils->_init_encryption();
+}
+
+/**
+ * @brief Zipfian (s = 1) choice among count hashes, hash k is picked with
+ * a probability proportional to 1 / (k + 1).
+ */
+class Zipf
+{
+    Genode::uint64_t cdf[SquidSnapshot::HASH_COUNT];
+    Genode::uint64_t count;
+    Genode::uint64_t state = 0x9e3779b97f4a7c15ULL;
+
+    Genode::uint64_t next(void)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+
+  public:
+    Zipf(Genode::uint64_t count)
+      : count(count)
+    {
+        Genode::uint64_t const scale = 1ULL << 20;
+        Genode::uint64_t sum = 0;
+
+        for (Genode::uint64_t k = 0; k < count; k++) {
+            sum += scale / (k + 1);
+            cdf[k] = sum;
+        }
+    }
+
+    Genode::uint64_t pick(void)
+    {
+        Genode::uint64_t r = next() % cdf[count - 1];
+
+        Genode::uint64_t k = 0;
+        while (cdf[k] <= r)
+            k++;
+
+        return k;
+    }
+};
+
+/**
+ * @brief Writes rounds of Zipfian distributed pages, advancing the write
+ * histories after each round as if a snapshot finished. No snapshot is
+ * completed, the rounds keep overwriting the current one.
+ * @return Time spent writing.
+ */
+static Genode::uint64_t
+write_rounds(void** hashes,
+             Genode::uint64_t count,
+             char* page,
+             unsigned rounds)
+{
+    using SquidSnapshot::squidutils;
+
+    Genode::uint64_t const writes = 1000;
+
+    Zipf zipf(count);
+    Genode::uint64_t us = 0;
+
+    for (unsigned round = 0; round < rounds; round++) {
+        Genode::uint64_t start = squidutils->_timer.elapsed_us();
+
+        for (Genode::uint64_t i = 0; i < writes; i++) {
+            page[0] = (char)i;
+
+            Genode::size_t const size = SquidSnapshot::MAX_PAYLOAD_SIZE;
+            if (squid_write(hashes[zipf.pick()], page, size) != SQUID_NONE)
+                Genode::error("SQUID: write: ", i);
+        }
+
+        us += squidutils->_timer.elapsed_us() - start;
+
+        SquidSnapshot::global_squid->classifier.advance();
+    }
+
+    return us;
+}
+
+void
+squid_benchmark_hotcold(void)
+{
+    using SquidSnapshot::Classifier;
+    using SquidSnapshot::squidutils;
+
+    static char page[SquidSnapshot::MAX_PAYLOAD_SIZE];
+    for (Genode::size_t i = 0; i < sizeof(page); i++)
+        page[i] = (char)(i * 7);
+
+    static void* hashes[SquidSnapshot::HASH_COUNT];
+    Genode::uint64_t count = acquire_hashes(hashes);
+    if (count == 0)
+        return;
+
+    Classifier::Config const configured = squidutils->classify_config();
+
+    Classifier::Config packed = configured;
+    if (packed.hot == 0)
+        packed.hot = Classifier::WINDOW / 2;
+
+    // INFO: Without a hot class every write goes to its own squid file.
+    Classifier::Config const modes[] = { { 0, configured.cold }, packed };
+    char const* const names[] = { "uniform", "hot/cold" };
+
+    unsigned const rounds = 8;
+    Genode::uint64_t const bytes = rounds * 1000 * sizeof(page);
+
+    for (unsigned mode = 0; mode < 2; mode++) {
+        squid_set_classify(modes[mode].hot, modes[mode].cold);
+
+        // INFO: The first rounds fill the write histories.
+        write_rounds(hashes, count, page, Classifier::WINDOW);
+
+        struct SquidStats before;
+        squid_stats(&before);
+
+        Genode::uint64_t us = write_rounds(hashes, count, page, rounds);
+
+        struct SquidStats after;
+        squid_stats(&after);
+
+        Genode::log("benchmark ",
+                    names[mode],
+                    ": ",
+                    us,
+                    " us, ",
+                    bytes / (us ? us : 1),
+                    " MB/s, ",
+                    after.classify_hot,
+                    " hot, ",
+                    after.classify_cold,
+                    " cold hashes, ",
+                    after.hot_pack_writes - before.hot_pack_writes,
+                    " packed writes");
+    }
+
+    squid_set_classify(configured.hot, configured.cold);
+
+    for (Genode::uint64_t i = 0; i < count; i++)
+        squid_delete(hashes[i]);
+}
+
+/**
+ * @brief Reads hash, as of the completed snapshot if it is not 0, and
+ * compares the payload with expected.
+ */
+static bool
+expect_payload(void* hash, Genode::uint64_t snapshot, char const* expected)
+{
+    static char payload[SquidSnapshot::MAX_PAYLOAD_SIZE];
+    Genode::memset(payload, 0, sizeof(payload));
+
+    enum SquidError err = snapshot ? squid_read_at(hash, snapshot, payload)
+                                   : squid_read(hash, payload);
+
+    return err == SQUID_NONE && Genode::strcmp(payload, expected) == 0;
+}
+
+/**
+ * @brief Runs the compaction in progress, if any, to its end.
+ */
+static bool
+complete_compaction(void)
+{
+    for (;;) {
+        struct SquidStats stats;
+        squid_stats(&stats);
+
+        if (stats.compaction_remaining == 0)
+            return true;
+
+        if (squid_compact_step(SquidSnapshot::HASH_COUNT) != SQUID_NONE)
+            return false;
+    }
+}
+
+/**
+ * @brief Writes a hash in two snapshots, merges them and reads the newer
+ * payload back, from current and from the merged snapshot.
+ */
+static bool
+squid_test_compaction(void)
+{
+    SquidSnapshot::Main& squid = *SquidSnapshot::global_squid;
+
+    char older[] = "compaction: older";
+    char newer[] = "compaction: newer";
+
+    void* hash = nullptr;
+    if (squid_hash(&hash) != SQUID_NONE)
+        return false;
+
+    // INFO: A compaction started by finish() would refuse ours.
+    bool passed = complete_compaction() &&
+                  squid_write(hash, older, sizeof(older)) == SQUID_NONE;
+    squid.finish();
+
+    passed = passed && squid_write(hash, newer, sizeof(newer)) == SQUID_NONE;
+    squid.finish();
+
+    passed = passed && complete_compaction() && squid.history.size() >= 2;
+
+    if (passed) {
+        Genode::size_t const newest = squid.history.size() - 1;
+        Genode::uint64_t const from = squid.history.at(newest - 1);
+        Genode::uint64_t const to = squid.history.at(newest);
+
+        passed = squid_compact(from, to) == SQUID_NONE &&
+                 complete_compaction() && !squid.history.contains(from) &&
+                 expect_payload(hash, 0, newer) &&
+                 expect_payload(hash, to + 1, newer);
+    }
+
+    squid_delete(hash);
+
+    return passed;
+}
+
+/**
+ * @brief Overwrites a hash after a snapshot and reads both versions back,
+ * the older one from that snapshot.
+ */
+static bool
+squid_test_history(void)
+{
+    SquidSnapshot::Main& squid = *SquidSnapshot::global_squid;
+
+    char older[] = "history: older";
+    char newer[] = "history: newer";
+
+    void* hash = nullptr;
+    if (squid_hash(&hash) != SQUID_NONE)
+        return false;
+
+    bool passed = squid_write(hash, older, sizeof(older)) == SQUID_NONE;
+    squid.finish();
+
+    passed = passed && squid.history.size() > 0;
+
+    Genode::uint64_t const snapshot =
+      passed ? squid.history.at(squid.history.size() - 1) : 0;
+
+    passed = passed && squid_write(hash, newer, sizeof(newer)) == SQUID_NONE;
+    squid.finish();
+
+    passed = passed && expect_payload(hash, snapshot, older) &&
+             expect_payload(hash, 0, newer) &&
+             expect_payload(hash, squid.history.at(squid.history.size() - 1),
+                            newer);
+
+    squid_delete(hash);
+
+    return passed;
+}
+
+/**
+ * @brief Backend of a standby squid for the replication test. Its squid
+ * root lives below a directory of the primary's file system, everything
+ * else is the primary's, including the file system the streams are on.
+ */
+class StandbyBackend : public SquidSnapshot::Backend
+{
+    typedef SquidSnapshot::Path Path;
+    typedef SquidSnapshot::Error Error;
+
+    class PrefixStorage : public SquidSnapshot::Storage
+    {
+        SquidSnapshot::Storage& _storage;
+        Path const _prefix;
+
+        Path _path(Path const& path) { return Path(_prefix, path); }
+
+      public:
+        PrefixStorage(SquidSnapshot::Storage& storage, Path const& prefix)
+          : _storage(storage)
+          , _prefix(prefix)
+        {
+        }
+
+        Error create_dir(Path const& path) override
+        {
+            return _storage.create_dir(_path(path));
+        }
+
+        bool directory_exists(Path const& path) override
+        {
+            return _storage.directory_exists(_path(path));
+        }
+
+        bool file_exists(Path const& path) override
+        {
+            return _storage.file_exists(_path(path));
+        }
+
+        Error write(Path const& path, void const* data, size_t size) override
+        {
+            return _storage.write(_path(path), data, size);
+        }
+
+        Error read(Path const& path,
+                   void* data,
+                   size_t capacity,
+                   size_t& size) override
+        {
+            return _storage.read(_path(path), data, capacity, size);
+        }
+
+        Error write_at(Path const& path,
+                       Genode::uint64_t offset,
+                       void const* data,
+                       size_t size) override
+        {
+            return _storage.write_at(_path(path), offset, data, size);
+        }
+
+        Error read_at(Path const& path,
+                      Genode::uint64_t offset,
+                      void* data,
+                      size_t size,
+                      size_t& read) override
+        {
+            return _storage.read_at(_path(path), offset, data, size, read);
+        }
+
+        Error copy(Path const& from, Path const& to) override
+        {
+            return _storage.copy(_path(from), _path(to));
+        }
+
+        Error unlink(Path const& path) override
+        {
+            return _storage.unlink(_path(path));
+        }
+
+        Error rename(Path const& from, Path const& to) override
+        {
+            return _storage.rename(_path(from), _path(to));
+        }
+
+        bool list(Path const& path, Entry_handler& handler) override
+        {
+            return _storage.list(_path(path), handler);
+        }
+
+        bool concurrent(void) const override
+        {
+            return _storage.concurrent();
+        }
+    };
+
+    SquidSnapshot::Backend& _backend;
+    PrefixStorage _storage;
+
+  public:
+    StandbyBackend(SquidSnapshot::Backend& backend, Path const& root)
+      : _backend(backend)
+      , _storage(backend.storage(), root)
+    {
+    }
+
+    Genode::Allocator& heap(void) override { return _backend.heap(); }
+    SquidSnapshot::Storage& storage(void) override { return _storage; }
+    SquidSnapshot::Clock& clock(void) override { return _backend.clock(); }
+
+    SquidSnapshot::ConfigSource& config(void) override
+    {
+        return _backend.config();
+    }
+
+    unsigned cpu_count(void) override { return _backend.cpu_count(); }
+
+    SquidSnapshot::Stream* open_stream(Path const& path, bool write) override
+    {
+        return _backend.open_stream(path, write);
+    }
+
+    void close_stream(SquidSnapshot::Stream* stream) override
+    {
+        _backend.close_stream(stream);
+    }
+
+    SquidSnapshot::WorkerPool* create_pool(unsigned workers,
+                                           unsigned cpu) override
+    {
+        return _backend.create_pool(workers, cpu);
+    }
+
+    void destroy_pool(SquidSnapshot::WorkerPool* pool) override
+    {
+        _backend.destroy_pool(pool);
+    }
+};
+
+/**
+ * @brief Removes the squid root of utils with all its snapshots.
+ */
+static void
+remove_root(SquidSnapshot::SquidUtils& utils)
+{
+    SquidSnapshot::Path const root("/", SquidSnapshot::SQUIDROOT);
+
+    // INFO: Entries are collected first, a listing need not survive the
+    // removal of its entries.
+    static const unsigned MAX_ENTRIES = 16;
+
+    SquidSnapshot::Path entries[MAX_ENTRIES];
+    bool dirs[MAX_ENTRIES];
+    unsigned count = 0;
+
+    utils._storage.for_each_entry(root, [&](char const* name, bool dir) {
+        if (count == MAX_ENTRIES)
+            return;
+
+        entries[count] = SquidSnapshot::Path(root, "/", name);
+        dirs[count++] = dir;
+    });
+
+    for (unsigned i = 0; i < count; i++) {
+        if (dirs[i])
+            utils.removetree(entries[i]);
+        else
+            utils.remove(entries[i]);
+    }
+
+    utils.remove(root);
+}
+
+/**
+ * @brief Exports a snapshot, imports it into a standby squid with a fresh
+ * root and compares the payload there.
+ */
+static bool
+squid_test_replication(void)
+{
+    using SquidSnapshot::Main;
+    using SquidSnapshot::SquidUtils;
+
+    Main& primary = *SquidSnapshot::global_squid;
+    SquidUtils& primary_utils = *SquidSnapshot::squidutils;
+
+    SquidSnapshot::Path const stream("/squid-test.stream");
+    SquidSnapshot::Path const root("/squid-standby");
+
+    char payload[] = "replication: payload";
+
+    void* hash = nullptr;
+    if (squid_hash(&hash) != SQUID_NONE)
+        return false;
+
+    unsigned long long slot = 0;
+    bool passed = squid_write(hash, payload, sizeof(payload)) == SQUID_NONE &&
+                  squid_slot(hash, &slot) == SQUID_NONE;
+    primary.finish();
+
+    passed = passed && primary.history.size() > 0 &&
+             squid_export(stream.string(),
+                          primary.history.at(primary.history.size() - 1),
+                          0) == SQUID_NONE;
+
+    squid_delete(hash);
+
+    if (!passed)
+        return false;
+
+    // INFO: The squid code reaches its state through the globals, they
+    // point to the standby until it is gone again.
+    static Genode::Constructible<SquidUtils> utils;
+    static Genode::Constructible<Main> standby;
+
+    primary_utils.createdir(root);
+
+    StandbyBackend backend(primary_utils._backend, root);
+
+    utils.construct(backend);
+    SquidSnapshot::squidutils = &*utils;
+
+    // INFO: Leftovers of an interrupted run would hold the imported id.
+    remove_root(*utils);
+
+    standby.construct(&*utils);
+    SquidSnapshot::global_squid = &*standby;
+
+    unsigned long long id = 0;
+    void* copy = nullptr;
+
+    passed = squid_import(stream.string(), &id) == SQUID_NONE &&
+             squid_hash_at(&copy, slot) == SQUID_NONE &&
+             expect_payload(copy, 0, payload) &&
+             expect_payload(copy, id, payload);
+
+    standby.destruct();
+    remove_root(*utils);
+    utils.destruct();
+
+    SquidSnapshot::global_squid = &primary;
+    SquidSnapshot::squidutils = &primary_utils;
+
+    primary_utils.remove(root);
+    primary_utils.remove(stream);
+
+    return passed;
+}
+
+/**
+ * @brief Deletes a hash held by a completed snapshot and one only written
+ * to current, reclaims and reallocates their slots, and checks that the
+ * new hashes do not read the old payloads.
+ */
+static bool
+squid_test_reclaim(void)
+{
+    SquidSnapshot::Main& squid = *SquidSnapshot::global_squid;
+
+    char stored[] = "reclaim: in a snapshot";
+    char written[] = "reclaim: in current";
+    char const* const payloads[] = { stored, written };
+
+    void* hashes[2] = { nullptr, nullptr };
+    unsigned long long slots[2] = { 0, 0 };
+
+    if (squid_hash(&hashes[0]) != SQUID_NONE)
+        return false;
+
+    bool passed = squid_hash(&hashes[1]) == SQUID_NONE &&
+                  squid_write(hashes[0], stored, sizeof(stored)) == SQUID_NONE;
+    squid.finish();
+
+    passed = passed &&
+             squid_write(hashes[1], written, sizeof(written)) == SQUID_NONE;
+
+    for (unsigned i = 0; i < 2; i++) {
+        passed = passed && squid_slot(hashes[i], &slots[i]) == SQUID_NONE;
+        squid_delete(hashes[i]);
+    }
+
+    passed = passed && squid_reclaim(0) == SQUID_NONE;
+
+    for (unsigned i = 0; i < 2; i++)
+        passed = passed && squid_hash_at(&hashes[i], slots[i]) == SQUID_NONE;
+
+    // INFO: Checked again once the tombstones are part of a completed
+    // snapshot.
+    for (unsigned round = 0; passed && round < 2; round++) {
+        if (round == 1)
+            squid.finish();
+
+        for (unsigned i = 0; i < 2; i++)
+            passed = passed && !expect_payload(hashes[i], 0, payloads[i]);
+    }
+
+    for (unsigned i = 0; i < 2; i++)
+        squid_delete(hashes[i]);
+
+    return passed;
+}
+
+bool
+squid_test_and_benchmark(void)
+{
+    Genode::log("testing squid...");
+
+    bool passed = false;
+
+    SquidSnapshot::Error err = SquidSnapshot::global_squid->test();
+    switch (err) {
+        case SquidSnapshot::Error::CreateFile:
+            Genode::error("\nfailed to create file\n");
+            break;
+
+        case SquidSnapshot::Error::WriteFile:
+            Genode::error("\nfailed to write\n");
+            break;
+
+        case SquidSnapshot::Error::ReadFile:
+            Genode::error("\nfailed to read\n");
+            break;
+
+        case SquidSnapshot::Error::CorruptedFile:
+            Genode::error("\nfile was corrupted\n");
+            break;
+
+        default:
+            Genode::log("passed.");
+            passed = true;
+            break;
+    }
+
+    if (!squid_test_compaction()) {
+        Genode::error("\ncompaction lost data\n");
+        passed = false;
+    }
+
+    if (!squid_test_history()) {
+        Genode::error("\nsnapshot returned the wrong version\n");
+        passed = false;
+    }
+
+    if (!squid_test_replication()) {
+        Genode::error("\nstandby differs from the exported snapshot\n");
+        passed = false;
+    }
+
+    if (!squid_test_reclaim()) {
+        Genode::error("\nreallocated hash read stale data\n");
+        passed = false;
+    }
+
+    Genode::log("benchmarking squid...");
+
+    squid_benchmark_encryption();
+    squid_benchmark_staging();
+    squid_benchmark_parallel();
+    squid_benchmark_hotcold();
+    squid_benchmark();
+    SquidSnapshot::global_squid->finish();
+
+    Genode::log("benchmark finished.");
+
+    return passed;
+}
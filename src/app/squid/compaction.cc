@@ -0,0 +1,237 @@
+#include "squid.h"
+#include "squidlib.h"
+
+namespace SquidSnapshot {
+
+    namespace {
+        /**
+         * @brief Files and directories of one snapshot tree, including its
+         * HotPack.
+         */
+        const uint64_t TREE_SIZE =
+          HASH_COUNT + 1 + ROOT_SIZE * L1_SIZE + ROOT_SIZE + 1;
+    }
+
+    Path Compactor::to_path(void)
+    {
+        Genode::String<1024> path("/", SQUIDROOT, "/compact");
+        return path;
+    }
+
+    bool Compactor::start(uint64_t from, uint64_t to)
+    {
+        if (is_running())
+            return false;
+
+        SnapshotHistory& history = SquidSnapshot::global_squid->history;
+
+        count = 0;
+        for (size_t i = 0; i < history.size(); i++) {
+            if (history.at(i) >= from && history.at(i) <= to)
+                ids[count++] = history.at(i);
+        }
+
+        if (count < 2) {
+            count = 0;
+            return true;
+        }
+
+        merged_id = ids[count - 1] + 1;
+        if (history.contains(merged_id)) {
+            Genode::error(SQUID_ERROR_FMT "can't compact, snapshot ",
+                          merged_id,
+                          " exists");
+            count = 0;
+            return true;
+        }
+
+        // INFO: Leftovers of an interrupted compaction are cleared first.
+        if (SquidSnapshot::squidutils->_storage.directory_exists(to_path())) {
+            state = CLEARING;
+        } else {
+            SquidSnapshot::squidutils->createtree(to_path());
+            state = COPYING;
+        }
+
+        cursor = 0;
+
+        return true;
+    }
+
+    bool Compactor::remove_tree(Path const& root, uint64_t& budget)
+    {
+        // INFO: The cursor walks the squid files and the HotPack first,
+        // then the L2, L1 and root directories, so that directories are
+        // empty when removed.
+        uint64_t const files = HASH_COUNT + 1;
+
+        for (; cursor < TREE_SIZE && budget > 0; cursor++, budget--) {
+            Path path;
+
+            if (cursor < HASH_COUNT) {
+                path = hash_path(root, cursor);
+            } else if (cursor == HASH_COUNT) {
+                path = HotPack::to_path(root);
+            } else if (cursor < files + ROOT_SIZE * L1_SIZE) {
+                uint64_t index = cursor - files;
+                path = Path(root, "/", index / L1_SIZE, "/", index % L1_SIZE);
+            } else if (cursor < TREE_SIZE - 1) {
+                uint64_t index = cursor - files - ROOT_SIZE * L1_SIZE;
+                path = Path(root, "/", index);
+            } else {
+                path = root;
+            }
+
+            if (SquidSnapshot::squidutils->remove(path) != Error::None)
+                Genode::warning("squid: couldn't remove ", path);
+        }
+
+        return cursor == TREE_SIZE;
+    }
+
+    Error Compactor::copy_packed(Path const& snapshot, uint64_t slot)
+    {
+        SquidUtils* utils = SquidSnapshot::squidutils;
+
+        void* record = utils->_heap.alloc(HotPack::RECORD_SIZE);
+
+        size_t size = 0;
+        Error err = HotPack::read(
+          snapshot, slot, record, HotPack::RECORD_SIZE, size);
+
+        if (err == Error::None)
+            err = utils->_storage.write(
+              hash_path(to_path(), slot), record, size);
+
+        utils->_heap.free(record, HotPack::RECORD_SIZE);
+
+        return err;
+    }
+
+    Error Compactor::copy(uint64_t& budget)
+    {
+        IoScheduler& io = SquidSnapshot::global_squid->io_scheduler;
+
+        SnapshotHistory& history = SquidSnapshot::global_squid->history;
+
+        for (; cursor < HASH_COUNT && budget > 0; cursor++, budget--) {
+            for (size_t i = count; i-- > 0;) {
+                if (!history.has(ids[i], cursor))
+                    continue;
+
+                Path snapshot = SnapshotHistory::to_path(ids[i]);
+
+                // INFO: Records of a HotPack are unpacked into squid files,
+                // the merged snapshot has no pack of its own.
+                uint64_t start = io.admit(MAX_PAYLOAD_SIZE);
+
+                Error err = Error::None;
+                if (history.is_packed(ids[i], cursor))
+                    err = copy_packed(snapshot, cursor);
+                else
+                    err = SquidSnapshot::squidutils->copy(
+                      hash_path(snapshot, cursor),
+                      hash_path(to_path(), cursor));
+
+                io.complete(start);
+
+                if (err != Error::None)
+                    return err;
+
+                break;
+            }
+        }
+
+        return Error::None;
+    }
+
+    Error Compactor::swap(void)
+    {
+        Error err = SquidSnapshot::squidutils->rename(
+          to_path(), SnapshotHistory::to_path(merged_id));
+
+        if (err != Error::None)
+            return err;
+
+        SnapshotHistory& history = SquidSnapshot::global_squid->history;
+
+        history.add(merged_id);
+        for (size_t i = 0; i < count; i++)
+            history.remove(ids[i]);
+
+        return Error::None;
+    }
+
+    Error Compactor::step(uint64_t budget)
+    {
+        while (budget > 0 && state != IDLE) {
+            switch (state) {
+                case CLEARING:
+                    if (remove_tree(to_path(), budget)) {
+                        SquidSnapshot::squidutils->createtree(to_path());
+
+                        state = COPYING;
+                        cursor = 0;
+                    }
+                    break;
+
+                case COPYING: {
+                    Error err = copy(budget);
+
+                    if (err == Error::None && cursor == HASH_COUNT)
+                        err = swap();
+
+                    if (err != Error::None) {
+                        Genode::error(SQUID_ERROR_FMT "compaction failed");
+
+                        // INFO: The partial snapshot is removed by the
+                        // next compaction.
+                        state = IDLE;
+                        return err;
+                    }
+
+                    if (cursor == HASH_COUNT) {
+                        state = REMOVING;
+                        removing = 0;
+                        cursor = 0;
+                    }
+                    break;
+                }
+
+                case REMOVING:
+                    if (remove_tree(SnapshotHistory::to_path(ids[removing]),
+                                    budget)) {
+                        cursor = 0;
+
+                        if (++removing == count)
+                            state = IDLE;
+                    }
+                    break;
+
+                case IDLE:
+                    break;
+            }
+        }
+
+        return Error::None;
+    }
+
+    uint64_t Compactor::remaining(void) const
+    {
+        switch (state) {
+            case CLEARING:
+                return TREE_SIZE - cursor + HASH_COUNT + count * TREE_SIZE;
+
+            case COPYING:
+                return HASH_COUNT - cursor + count * TREE_SIZE;
+
+            case REMOVING:
+                return (count - removing) * TREE_SIZE - cursor;
+
+            case IDLE:
+                break;
+        }
+
+        return 0;
+    }
+}; // namespace SquidSnapshot
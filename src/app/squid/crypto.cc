@@ -0,0 +1,553 @@
+#include "crypto.h"
+
+namespace SquidSnapshot {
+
+    namespace {
+
+        const uint8_t SBOX[256] = {
+            0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67,
+            0x2b, 0xfe, 0xd7, 0xab, 0x76, 0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59,
+            0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0, 0xb7,
+            0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1,
+            0x71, 0xd8, 0x31, 0x15, 0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05,
+            0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75, 0x09, 0x83,
+            0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29,
+            0xe3, 0x2f, 0x84, 0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b,
+            0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf, 0xd0, 0xef, 0xaa,
+            0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c,
+            0x9f, 0xa8, 0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc,
+            0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2, 0xcd, 0x0c, 0x13, 0xec,
+            0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19,
+            0x73, 0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee,
+            0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb, 0xe0, 0x32, 0x3a, 0x0a, 0x49,
+            0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+            0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4,
+            0xea, 0x65, 0x7a, 0xae, 0x08, 0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6,
+            0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a, 0x70,
+            0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9,
+            0x86, 0xc1, 0x1d, 0x9e, 0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e,
+            0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf, 0x8c, 0xa1,
+            0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0,
+            0x54, 0xbb, 0x16
+        };
+
+        inline uint8_t xtime(uint8_t x)
+        {
+            return (uint8_t)((x << 1) ^ ((x >> 7) * 0x1b));
+        }
+
+        inline uint64_t load_be64(uint8_t const* p)
+        {
+            uint64_t v = 0;
+            for (unsigned i = 0; i < 8; i++)
+                v = (v << 8) | p[i];
+
+            return v;
+        }
+
+        inline void store_be64(uint8_t* p, uint64_t v)
+        {
+            for (unsigned i = 0; i < 8; i++)
+                p[i] = (uint8_t)(v >> (56 - 8 * i));
+        }
+
+        /**
+         * @brief Increments the last 32 bits of a GCM counter block.
+         */
+        inline void inc32(uint8_t block[16])
+        {
+            for (unsigned i = 15; i >= 12; i--) {
+                if (++block[i] != 0)
+                    break;
+            }
+        }
+
+        inline void fill_j0(uint8_t const nonce[Cipher::NONCE_SIZE],
+                            uint8_t j0[16])
+        {
+            __builtin_memcpy(j0, nonce, Cipher::NONCE_SIZE);
+            j0[12] = 0;
+            j0[13] = 0;
+            j0[14] = 0;
+            j0[15] = 1;
+        }
+
+        void expand_key(uint8_t const key[Cipher::KEY_SIZE], uint8_t* rk)
+        {
+            __builtin_memcpy(rk, key, Cipher::KEY_SIZE);
+
+            uint8_t rcon = 1;
+            for (unsigned i = 16; i < 176; i += 4) {
+                uint8_t t[4] = { rk[i - 4], rk[i - 3], rk[i - 2], rk[i - 1] };
+
+                if (i % 16 == 0) {
+                    uint8_t first = t[0];
+                    t[0] = SBOX[t[1]] ^ rcon;
+                    t[1] = SBOX[t[2]];
+                    t[2] = SBOX[t[3]];
+                    t[3] = SBOX[first];
+                    rcon = xtime(rcon);
+                }
+
+                for (unsigned j = 0; j < 4; j++)
+                    rk[i + j] = rk[i - 16 + j] ^ t[j];
+            }
+        }
+
+        void encrypt_block(uint8_t const* rk,
+                           uint8_t const in[16],
+                           uint8_t out[16])
+        {
+            uint8_t s[16];
+            for (unsigned i = 0; i < 16; i++)
+                s[i] = in[i] ^ rk[i];
+
+            for (unsigned round = 1; round <= 10; round++) {
+                uint8_t t[16];
+
+                // SubBytes and ShiftRows
+                for (unsigned c = 0; c < 4; c++)
+                    for (unsigned r = 0; r < 4; r++)
+                        t[c * 4 + r] = SBOX[s[((c + r) & 3) * 4 + r]];
+
+                if (round == 10) {
+                    __builtin_memcpy(s, t, 16);
+                } else {
+                    // MixColumns
+                    for (unsigned c = 0; c < 4; c++) {
+                        uint8_t a0 = t[c * 4 + 0], a1 = t[c * 4 + 1];
+                        uint8_t a2 = t[c * 4 + 2], a3 = t[c * 4 + 3];
+                        uint8_t all = a0 ^ a1 ^ a2 ^ a3;
+
+                        s[c * 4 + 0] = a0 ^ all ^ xtime(a0 ^ a1);
+                        s[c * 4 + 1] = a1 ^ all ^ xtime(a1 ^ a2);
+                        s[c * 4 + 2] = a2 ^ all ^ xtime(a2 ^ a3);
+                        s[c * 4 + 3] = a3 ^ all ^ xtime(a3 ^ a0);
+                    }
+                }
+
+                for (unsigned i = 0; i < 16; i++)
+                    s[i] ^= rk[round * 16 + i];
+            }
+
+            __builtin_memcpy(out, s, 16);
+        }
+
+        /**
+         * @brief y = (y ^ block) * h in GF(2^128), bit by bit.
+         */
+        void ghash_block(uint8_t const h[16],
+                         uint8_t y[16],
+                         uint8_t const block[16])
+        {
+            uint8_t x[16];
+            for (unsigned i = 0; i < 16; i++)
+                x[i] = y[i] ^ block[i];
+
+            uint64_t v_hi = load_be64(h), v_lo = load_be64(h + 8);
+            uint64_t z_hi = 0, z_lo = 0;
+
+            for (unsigned i = 0; i < 128; i++) {
+                if ((x[i / 8] >> (7 - i % 8)) & 1) {
+                    z_hi ^= v_hi;
+                    z_lo ^= v_lo;
+                }
+
+                bool lsb = v_lo & 1;
+                v_lo = (v_lo >> 1) | (v_hi << 63);
+                v_hi >>= 1;
+                if (lsb)
+                    v_hi ^= 0xe100000000000000ULL;
+            }
+
+            store_be64(y, z_hi);
+            store_be64(y + 8, z_lo);
+        }
+
+        void ghash(uint8_t const h[16],
+                   uint8_t y[16],
+                   uint8_t const* data,
+                   size_t len)
+        {
+            for (; len >= 16; data += 16, len -= 16)
+                ghash_block(h, y, data);
+
+            if (len) {
+                uint8_t last[16] = {};
+                __builtin_memcpy(last, data, len);
+                ghash_block(h, y, last);
+            }
+        }
+
+        void gcm_portable(uint8_t const* rk,
+                          uint8_t const h[16],
+                          uint8_t const nonce[Cipher::NONCE_SIZE],
+                          uint8_t const* aad,
+                          size_t aad_len,
+                          uint8_t const* src,
+                          uint8_t* dst,
+                          size_t len,
+                          bool decrypt,
+                          uint8_t tag[Cipher::TAG_SIZE])
+        {
+            uint8_t y[16] = {};
+            ghash(h, y, aad, aad_len);
+
+            uint8_t ctr[16], ek0[16];
+            fill_j0(nonce, ctr);
+            encrypt_block(rk, ctr, ek0);
+
+            for (size_t off = 0; off < len; off += 16) {
+                size_t n = len - off < 16 ? len - off : 16;
+
+                uint8_t in[16] = {}, ks[16], out[16] = {};
+                __builtin_memcpy(in, src + off, n);
+
+                inc32(ctr);
+                encrypt_block(rk, ctr, ks);
+
+                for (size_t i = 0; i < n; i++)
+                    out[i] = in[i] ^ ks[i];
+
+                ghash_block(h, y, decrypt ? in : out);
+                __builtin_memcpy(dst + off, out, n);
+            }
+
+            uint8_t lengths[16];
+            store_be64(lengths, (uint64_t)aad_len * 8);
+            store_be64(lengths + 8, (uint64_t)len * 8);
+            ghash_block(h, y, lengths);
+
+            for (unsigned i = 0; i < 16; i++)
+                tag[i] = y[i] ^ ek0[i];
+        }
+
+#if defined(__x86_64__)
+
+        typedef long long v2di __attribute__((vector_size(16)));
+        typedef int v4si __attribute__((vector_size(16)));
+        typedef char v16qi __attribute__((vector_size(16)));
+
+#define SQUID_AESNI __attribute__((target("aes,pclmul,ssse3")))
+
+        bool cpu_has_aesni(void)
+        {
+            unsigned a = 1, b = 0, c = 0, d = 0;
+            asm volatile("cpuid" : "+a"(a), "=b"(b), "+c"(c), "=d"(d));
+
+            // ECX: PCLMULQDQ (1), SSSE3 (9), AES (25)
+            return (c & (1u << 1)) && (c & (1u << 9)) && (c & (1u << 25));
+        }
+
+        SQUID_AESNI inline v2di load(uint8_t const* p)
+        {
+            v2di v;
+            __builtin_memcpy(&v, p, 16);
+            return v;
+        }
+
+        SQUID_AESNI inline void store(uint8_t* p, v2di v)
+        {
+            __builtin_memcpy(p, &v, 16);
+        }
+
+        SQUID_AESNI inline v2di bswap(v2di v)
+        {
+            const v16qi mask = { 15, 14, 13, 12, 11, 10, 9, 8,
+                                 7,  6,  5,  4,  3,  2,  1, 0 };
+            return (v2di)__builtin_ia32_pshufb128((v16qi)v, mask);
+        }
+
+        /**
+         * @brief Carry-less multiplication with reduction modulo the GCM
+         * polynomial on byte-reflected operands (Gueron and Kounavis,
+         * "Intel Carry-Less Multiplication Instruction and its Usage for
+         * Computing the GCM Mode").
+         */
+        SQUID_AESNI v2di gfmul(v2di a, v2di b)
+        {
+            v2di t3 = __builtin_ia32_pclmulqdq128(a, b, 0x00);
+            v2di t4 = __builtin_ia32_pclmulqdq128(a, b, 0x10);
+            v2di t5 = __builtin_ia32_pclmulqdq128(a, b, 0x01);
+            v2di t6 = __builtin_ia32_pclmulqdq128(a, b, 0x11);
+
+            t4 ^= t5;
+            t5 = __builtin_ia32_pslldqi128(t4, 64);
+            t4 = __builtin_ia32_psrldqi128(t4, 64);
+            t3 ^= t5;
+            t6 ^= t4;
+
+            v2di t7 = (v2di)__builtin_ia32_psrldi128((v4si)t3, 31);
+            v2di t8 = (v2di)__builtin_ia32_psrldi128((v4si)t6, 31);
+            t3 = (v2di)__builtin_ia32_pslldi128((v4si)t3, 1);
+            t6 = (v2di)__builtin_ia32_pslldi128((v4si)t6, 1);
+
+            v2di t9 = __builtin_ia32_psrldqi128(t7, 96);
+            t8 = __builtin_ia32_pslldqi128(t8, 32);
+            t7 = __builtin_ia32_pslldqi128(t7, 32);
+            t3 |= t7;
+            t6 |= t8;
+            t6 |= t9;
+
+            t7 = (v2di)__builtin_ia32_pslldi128((v4si)t3, 31);
+            t8 = (v2di)__builtin_ia32_pslldi128((v4si)t3, 30);
+            t9 = (v2di)__builtin_ia32_pslldi128((v4si)t3, 25);
+            t7 ^= t8;
+            t7 ^= t9;
+            t8 = __builtin_ia32_psrldqi128(t7, 32);
+            t7 = __builtin_ia32_pslldqi128(t7, 96);
+            t3 ^= t7;
+
+            v2di t2 = (v2di)__builtin_ia32_psrldi128((v4si)t3, 1);
+            t4 = (v2di)__builtin_ia32_psrldi128((v4si)t3, 2);
+            t5 = (v2di)__builtin_ia32_psrldi128((v4si)t3, 7);
+            t2 ^= t4;
+            t2 ^= t5;
+            t2 ^= t8;
+            t3 ^= t2;
+            t6 ^= t3;
+
+            return t6;
+        }
+
+        SQUID_AESNI inline v2di aes_block(v2di const rk[11], v2di b)
+        {
+            b ^= rk[0];
+            for (unsigned r = 1; r < 10; r++)
+                b = __builtin_ia32_aesenc128(b, rk[r]);
+
+            return __builtin_ia32_aesenclast128(b, rk[10]);
+        }
+
+        SQUID_AESNI v2di ghash_bytes(v2di h, v2di y, uint8_t const* p, size_t n)
+        {
+            for (; n >= 16; p += 16, n -= 16)
+                y = gfmul(y ^ bswap(load(p)), h);
+
+            if (n) {
+                uint8_t last[16] = {};
+                __builtin_memcpy(last, p, n);
+                y = gfmul(y ^ bswap(load(last)), h);
+            }
+
+            return y;
+        }
+
+        SQUID_AESNI void gcm_aesni(uint8_t const* round_keys,
+                                   uint8_t const hash_key[16],
+                                   uint8_t const nonce[Cipher::NONCE_SIZE],
+                                   uint8_t const* aad,
+                                   size_t aad_len,
+                                   uint8_t const* src,
+                                   uint8_t* dst,
+                                   size_t len,
+                                   bool decrypt,
+                                   uint8_t tag[Cipher::TAG_SIZE])
+        {
+            v2di rk[11];
+            for (unsigned r = 0; r < 11; r++)
+                rk[r] = load(round_keys + r * 16);
+
+            v2di h = bswap(load(hash_key));
+            v2di y = ghash_bytes(h, (v2di){ 0, 0 }, aad, aad_len);
+
+            uint8_t ctr[16];
+            fill_j0(nonce, ctr);
+            v2di ek0 = aes_block(rk, load(ctr));
+
+            size_t off = 0;
+
+            // INFO: Four independent counter blocks per iteration keep the
+            // AES pipeline busy while GHASH runs on the previous results.
+            for (; len - off >= 64; off += 64) {
+                v2di b[4];
+                for (unsigned i = 0; i < 4; i++) {
+                    inc32(ctr);
+                    b[i] = load(ctr) ^ rk[0];
+                }
+
+                for (unsigned r = 1; r < 10; r++)
+                    for (unsigned i = 0; i < 4; i++)
+                        b[i] = __builtin_ia32_aesenc128(b[i], rk[r]);
+
+                for (unsigned i = 0; i < 4; i++) {
+                    v2di in = load(src + off + i * 16);
+                    v2di out = __builtin_ia32_aesenclast128(b[i], rk[10]) ^ in;
+
+                    y = gfmul(y ^ bswap(decrypt ? in : out), h);
+                    store(dst + off + i * 16, out);
+                }
+            }
+
+            for (; off < len; off += 16) {
+                size_t n = len - off < 16 ? len - off : 16;
+
+                uint8_t in[16] = {}, out[16] = {};
+                __builtin_memcpy(in, src + off, n);
+
+                inc32(ctr);
+                store(out, aes_block(rk, load(ctr)) ^ load(in));
+                __builtin_memset(out + n, 0, 16 - n);
+
+                y = gfmul(y ^ bswap(load(decrypt ? in : out)), h);
+                __builtin_memcpy(dst + off, out, n);
+            }
+
+            uint8_t lengths[16];
+            store_be64(lengths, (uint64_t)aad_len * 8);
+            store_be64(lengths + 8, (uint64_t)len * 8);
+            y = gfmul(y ^ bswap(load(lengths)), h);
+
+            store(tag, bswap(y) ^ ek0);
+        }
+
+#undef SQUID_AESNI
+
+#else
+
+        bool cpu_has_aesni(void)
+        {
+            return false;
+        }
+
+#endif // __x86_64__
+    }
+
+    Cipher::Cipher(uint8_t const key[KEY_SIZE])
+      : accelerated(cpu_has_aesni())
+    {
+        expand_key(key, round_keys);
+
+        uint8_t zero[16] = {};
+        encrypt_block(round_keys, zero, hash_key);
+    }
+
+    Cipher::~Cipher(void)
+    {
+        // INFO: volatile keeps the compiler from eliding the wipe.
+        volatile uint8_t* p = round_keys;
+        for (size_t i = 0; i < sizeof(round_keys); i++)
+            p[i] = 0;
+
+        p = hash_key;
+        for (size_t i = 0; i < sizeof(hash_key); i++)
+            p[i] = 0;
+    }
+
+    void Cipher::seal(uint8_t const nonce[NONCE_SIZE],
+                      uint8_t const* aad,
+                      size_t aad_len,
+                      uint8_t const* src,
+                      uint8_t* dst,
+                      size_t len,
+                      uint8_t tag[TAG_SIZE])
+    {
+#if defined(__x86_64__)
+        if (accelerated) {
+            gcm_aesni(round_keys,
+                      hash_key,
+                      nonce,
+                      aad,
+                      aad_len,
+                      src,
+                      dst,
+                      len,
+                      false,
+                      tag);
+            return;
+        }
+#endif
+        gcm_portable(
+          round_keys, hash_key, nonce, aad, aad_len, src, dst, len, false, tag);
+    }
+
+    bool Cipher::open(uint8_t const nonce[NONCE_SIZE],
+                      uint8_t const* aad,
+                      size_t aad_len,
+                      uint8_t const* src,
+                      uint8_t* dst,
+                      size_t len,
+                      uint8_t const tag[TAG_SIZE])
+    {
+        uint8_t expected[TAG_SIZE];
+
+#if defined(__x86_64__)
+        if (accelerated)
+            gcm_aesni(round_keys,
+                      hash_key,
+                      nonce,
+                      aad,
+                      aad_len,
+                      src,
+                      dst,
+                      len,
+                      true,
+                      expected);
+        else
+#endif
+            gcm_portable(round_keys,
+                         hash_key,
+                         nonce,
+                         aad,
+                         aad_len,
+                         src,
+                         dst,
+                         len,
+                         true,
+                         expected);
+
+        uint8_t diff = 0;
+        for (size_t i = 0; i < TAG_SIZE; i++)
+            diff |= expected[i] ^ tag[i];
+
+        if (diff != 0) {
+            __builtin_memset(dst, 0, len);
+            return false;
+        }
+
+        return true;
+    }
+
+    void Cipher::derive(uint32_t master_id,
+                        uint32_t number,
+                        uint8_t key[KEY_SIZE]) const
+    {
+        // INFO: Label, master id and number, so that derived keys never
+        // collide with blocks encrypted for other purposes.
+        uint8_t block[16] = { 'S', 'Q', 'D', 'K', 'E', 'Y', 0, 1 };
+
+        for (unsigned i = 0; i < 4; i++) {
+            block[8 + i] = (uint8_t)(master_id >> (8 * i));
+            block[12 + i] = (uint8_t)(number >> (8 * i));
+        }
+
+        encrypt_block(round_keys, block, key);
+    }
+
+    bool Cipher::parse_key(char const* hex, uint8_t key[KEY_SIZE])
+    {
+        auto digit = [](char c) -> int {
+            if (c >= '0' && c <= '9')
+                return c - '0';
+            if (c >= 'a' && c <= 'f')
+                return c - 'a' + 10;
+            if (c >= 'A' && c <= 'F')
+                return c - 'A' + 10;
+            return -1;
+        };
+
+        for (size_t i = 0; i < KEY_SIZE; i++) {
+            int hi = digit(hex[2 * i]);
+            if (hi < 0)
+                return false;
+
+            int lo = digit(hex[2 * i + 1]);
+            if (lo < 0)
+                return false;
+
+            key[i] = (uint8_t)(hi << 4 | lo);
+        }
+
+        return hex[2 * KEY_SIZE] == 0;
+    }
+}; // namespace SquidSnapshot
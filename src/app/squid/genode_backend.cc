@@ -0,0 +1,439 @@
+#include "genode_backend.h"
+
+#include <base/log.h>
+#include <util/string.h>
+
+namespace SquidSnapshot {
+
+    Error GenodeBackend::VfsStorage::create_dir(Path const& path)
+    {
+        Vfs::Vfs_handle* handle = nullptr;
+        auto res =
+          _vfs_env.root_dir().opendir(path.string(), true, &handle, _heap);
+
+        if (res != Vfs::Directory_service::OPENDIR_ERR_NODE_ALREADY_EXISTS &&
+            res != Vfs::Directory_service::OPENDIR_OK) {
+
+            if (res == Vfs::Directory_service::OPENDIR_ERR_PERMISSION_DENIED)
+                Genode::error("reason: permission");
+
+            return Error::CreateFile;
+        }
+
+        if (handle)
+            handle->close();
+
+        return Error::None;
+    }
+
+    bool GenodeBackend::VfsStorage::directory_exists(Path const& path)
+    {
+        return _vfs_env.root_dir().directory(path.string());
+    }
+
+    bool GenodeBackend::VfsStorage::file_exists(Path const& path)
+    {
+        return _root_dir.file_exists(path);
+    }
+
+    Error GenodeBackend::VfsStorage::write(Path const& path,
+                                           void const* data,
+                                           size_t size)
+    {
+        try {
+            New_file file(_root_dir, path);
+
+            if (file.append((char const*)data, size) !=
+                New_file::Append_result::OK) {
+
+                return Error::WriteFile;
+            }
+
+        } catch (New_file::Create_failed) {
+            return Error::CreateFile;
+        }
+
+        return Error::None;
+    }
+
+    Error GenodeBackend::VfsStorage::read(Path const& path,
+                                          void* data,
+                                          size_t capacity,
+                                          size_t& size)
+    {
+        char* buffer = (char*)data;
+
+        Readonly_file::At at{ 0 };
+
+        try {
+            Readonly_file file(_root_dir, path);
+
+            while (at.value < capacity) {
+                size_t chunk = capacity - at.value;
+                if (chunk > 4096)
+                    chunk = 4096;
+
+                size_t const read_bytes =
+                  file.read(at, Byte_range_ptr(buffer + at.value, chunk));
+
+                at.value += read_bytes;
+
+                if (read_bytes < chunk)
+                    break;
+            }
+        } catch (...) {
+            return Error::ReadFile;
+        }
+
+        size = at.value;
+
+        return Error::None;
+    }
+
+    Error GenodeBackend::VfsStorage::write_at(Path const& path,
+                                              uint64_t offset,
+                                              void const* data,
+                                              size_t size)
+    {
+        typedef Vfs::Directory_service Ds;
+        typedef Vfs::File_io_service Fs;
+
+        // INFO: New_file truncates, so the file is opened directly.
+        Vfs::Vfs_handle* handle = nullptr;
+
+        Ds::Open_result res = _vfs_env.root_dir().open(
+          path.string(), Ds::OPEN_MODE_WRONLY, &handle, _heap);
+
+        if (res == Ds::OPEN_ERR_UNACCESSIBLE)
+            res = _vfs_env.root_dir().open(path.string(),
+                                           Ds::OPEN_MODE_WRONLY |
+                                             Ds::OPEN_MODE_CREATE,
+                                           &handle,
+                                           _heap);
+
+        if (res != Ds::OPEN_OK)
+            return Error::CreateFile;
+
+        Error result = Error::None;
+
+        for (size_t done = 0; done < size;) {
+            handle->seek(offset + done);
+
+            size_t written = 0;
+            Fs::Write_result const write_res = handle->fs().write(
+              handle,
+              Const_byte_range_ptr((char const*)data + done, size - done),
+              written);
+
+            if (write_res == Fs::WRITE_ERR_WOULD_BLOCK) {
+                _vfs_env.io().commit_and_wait();
+                continue;
+            }
+
+            if (write_res != Fs::WRITE_OK || written == 0) {
+                result = Error::WriteFile;
+                break;
+            }
+
+            done += written;
+        }
+
+        handle->close();
+
+        return result;
+    }
+
+    Error GenodeBackend::VfsStorage::read_at(Path const& path,
+                                             uint64_t offset,
+                                             void* data,
+                                             size_t size,
+                                             size_t& read)
+    {
+        Readonly_file::At at{ offset };
+
+        read = 0;
+
+        try {
+            Readonly_file file(_root_dir, path);
+
+            while (read < size) {
+                size_t const read_bytes = file.read(
+                  at, Byte_range_ptr((char*)data + read, size - read));
+
+                if (read_bytes == 0)
+                    break;
+
+                at.value += read_bytes;
+                read += read_bytes;
+            }
+        } catch (...) {
+            return Error::ReadFile;
+        }
+
+        return Error::None;
+    }
+
+    Error GenodeBackend::VfsStorage::copy(Path const& from, Path const& to)
+    {
+        char chunk[4096];
+        Readonly_file::At at{ 0 };
+
+        try {
+            Readonly_file src(_root_dir, from);
+            New_file dst(_root_dir, to);
+
+            for (;;) {
+                size_t const read_bytes =
+                  src.read(at, Byte_range_ptr(chunk, sizeof(chunk)));
+
+                if (read_bytes == 0)
+                    break;
+
+                if (dst.append(chunk, read_bytes) !=
+                    New_file::Append_result::OK)
+                    return Error::WriteFile;
+
+                at.value += read_bytes;
+            }
+
+        } catch (New_file::Create_failed) {
+            return Error::CreateFile;
+        } catch (...) {
+            return Error::ReadFile;
+        }
+
+        return Error::None;
+    }
+
+    Error GenodeBackend::VfsStorage::unlink(Path const& path)
+    {
+        switch (_vfs_env.root_dir().unlink(path.string())) {
+            case Vfs::Directory_service::UNLINK_OK:
+            case Vfs::Directory_service::UNLINK_ERR_NO_ENTRY:
+                return Error::None;
+
+            default:
+                return Error::DeleteFile;
+        }
+    }
+
+    Error GenodeBackend::VfsStorage::rename(Path const& from, Path const& to)
+    {
+        if (_vfs_env.root_dir().rename(from.string(), to.string()) !=
+            Vfs::Directory_service::RENAME_OK)
+            return Error::WriteFile;
+
+        return Error::None;
+    }
+
+    bool GenodeBackend::VfsStorage::list(Path const& path,
+                                         Entry_handler& handler)
+    {
+        try {
+            Directory dir(_root_dir, path);
+
+            dir.for_each_entry([&](Directory::Entry const& entry) {
+                handler.handle(entry.name().string(), entry.dir());
+            });
+        } catch (Directory::Nonexistent_directory) {
+            return false;
+        }
+
+        return true;
+    }
+
+    GenodeBackend::VfsStream::VfsStream(Root_directory& root_dir,
+                                        Path const& path,
+                                        bool write)
+    {
+        if (write)
+            _out.construct(root_dir, path);
+        else
+            _in.construct(root_dir, path);
+    }
+
+    Error GenodeBackend::VfsStream::write(void const* data, size_t size)
+    {
+        if (!_out.constructed())
+            return Error::WriteFile;
+
+        if (_out->append((char const*)data, size) !=
+            New_file::Append_result::OK)
+            return Error::WriteFile;
+
+        return Error::None;
+    }
+
+    Error GenodeBackend::VfsStream::read(void* data, size_t size, size_t& read)
+    {
+        read = 0;
+
+        if (!_in.constructed())
+            return Error::ReadFile;
+
+        while (read < size) {
+            size_t const read_bytes = _in->read(
+              _at, Byte_range_ptr((char*)data + read, size - read));
+
+            if (read_bytes == 0)
+                break;
+
+            _at.value += read_bytes;
+            read += read_bytes;
+        }
+
+        return Error::None;
+    }
+
+    uint64_t GenodeBackend::TimerClock::elapsed_us(void)
+    {
+        return _timer.elapsed_us();
+    }
+
+    uint64_t GenodeBackend::TimerClock::curr_time_us(void)
+    {
+        return _timer.curr_time().trunc_to_plain_us().value;
+    }
+
+    void GenodeBackend::TimerClock::usleep(uint64_t us)
+    {
+        _timer.usleep(us);
+    }
+
+    bool GenodeBackend::RomConfig::has_node(char const* node)
+    {
+        return _rom.xml().has_sub_node(node);
+    }
+
+    bool GenodeBackend::RomConfig::attribute(char const* node,
+                                             char const* attr,
+                                             Value& value)
+    {
+        Xml_node config = _rom.xml();
+        if (!config.has_sub_node(node))
+            return false;
+
+        Xml_node sub_node = config.sub_node(node);
+        if (!sub_node.has_attribute(attr))
+            return false;
+
+        value = sub_node.attribute_value(attr, Value());
+
+        return true;
+    }
+
+    size_t GenodeBackend::RomConfig::module(char const* name,
+                                            char* data,
+                                            size_t size)
+    {
+        try {
+            Attached_rom_dataspace rom(_env, name);
+
+            if (size > rom.size())
+                size = rom.size();
+
+            Genode::memcpy(data, rom.local_addr<char const>(), size);
+        } catch (...) {
+            return 0;
+        }
+
+        return size;
+    }
+
+    GenodeBackend::ThreadPool::Worker::Worker(Env& env,
+                                              unsigned index,
+                                              Affinity::Location location)
+      : Genode::Thread(env,
+                       Genode::Thread::Name("squid_worker_", index),
+                       64 * 1024,
+                       location,
+                       Genode::Thread::Weight(),
+                       env.cpu())
+      , index(index)
+    {
+    }
+
+    void GenodeBackend::ThreadPool::Worker::entry(void)
+    {
+        for (;;) {
+            start_sem.down();
+
+            // INFO: A start without a task terminates the worker.
+            if (task == nullptr)
+                break;
+
+            task->run(index);
+
+            done_sem.up();
+        }
+    }
+
+    GenodeBackend::ThreadPool::ThreadPool(Env& env,
+                                          Allocator& heap,
+                                          unsigned workers,
+                                          unsigned cpu)
+      : _heap(heap)
+      , _count(workers < MAX_WORKERS ? workers : MAX_WORKERS)
+    {
+        Affinity::Space space = env.cpu().affinity_space();
+
+        for (unsigned i = 0; i < _count; i++) {
+            Affinity::Location location =
+              space.location_of_index((cpu + i) % space.total());
+
+            _workers[i] = new (_heap) Worker(env, i, location);
+            _workers[i]->start();
+        }
+    }
+
+    GenodeBackend::ThreadPool::~ThreadPool(void)
+    {
+        for (unsigned i = 0; i < _count; i++) {
+            _workers[i]->task = nullptr;
+            _workers[i]->start_sem.up();
+            _workers[i]->join();
+
+            destroy(_heap, _workers[i]);
+        }
+    }
+
+    void GenodeBackend::ThreadPool::run(Task& task)
+    {
+        for (unsigned i = 0; i < _count; i++) {
+            _workers[i]->task = &task;
+            _workers[i]->start_sem.up();
+        }
+
+        for (unsigned i = 0; i < _count; i++)
+            _workers[i]->done_sem.down();
+    }
+
+    unsigned GenodeBackend::cpu_count(void)
+    {
+        return _env.cpu().affinity_space().total();
+    }
+
+    Stream* GenodeBackend::open_stream(Path const& path, bool write)
+    {
+        try {
+            return new (_heap) VfsStream(_root_dir, path, write);
+        } catch (...) {
+            return nullptr;
+        }
+    }
+
+    void GenodeBackend::close_stream(Stream* stream)
+    {
+        destroy(_heap, static_cast<VfsStream*>(stream));
+    }
+
+    WorkerPool* GenodeBackend::create_pool(unsigned workers, unsigned cpu)
+    {
+        return new (_heap) ThreadPool(_env, _heap, workers, cpu);
+    }
+
+    void GenodeBackend::destroy_pool(WorkerPool* pool)
+    {
+        destroy(_heap, static_cast<ThreadPool*>(pool));
+    }
+}; // namespace SquidSnapshot
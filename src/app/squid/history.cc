@@ -0,0 +1,191 @@
+#include "squid.h"
+#include "squidlib.h"
+
+#include <util/construct_at.h>
+#include <util/string.h>
+
+namespace SquidSnapshot {
+
+    void SnapshotHistory::scan(void)
+    {
+        count = 0;
+
+        Storage& storage = SquidSnapshot::squidutils->_storage;
+
+        storage.for_each_entry(Path("/", SQUIDROOT),
+                               [&](char const* name, bool dir) {
+            if (!dir)
+                return;
+
+            // INFO: Only completed snapshots have numeric names.
+            uint64_t id = 0;
+            if (ascii_to(name, id) != Genode::strlen(name))
+                return;
+
+            if (!add(id))
+                Genode::error(SQUID_ERROR_FMT "too many snapshots: ", id);
+        });
+    }
+
+    bool SnapshotHistory::add(uint64_t id)
+    {
+        if (count == MAX_SNAPSHOTS)
+            return false;
+
+        size_t i = count;
+        for (; i > 0 && ids[i - 1] > id; i--) {
+            ids[i] = ids[i - 1];
+            slots[i] = slots[i - 1];
+        }
+
+        ids[i] = id;
+        slots[i] = nullptr;
+        count++;
+
+        return true;
+    }
+
+    void SnapshotHistory::remove(uint64_t id)
+    {
+        size_t i = 0;
+        for (; i < count && ids[i] != id; i++)
+            ;
+
+        if (i == count)
+            return;
+
+        if (slots[i] != nullptr)
+            SquidSnapshot::squidutils->_heap.free(slots[i], sizeof(Index));
+
+        for (; i + 1 < count; i++) {
+            ids[i] = ids[i + 1];
+            slots[i] = slots[i + 1];
+        }
+
+        count--;
+    }
+
+    bool SnapshotHistory::contains(uint64_t id) const
+    {
+        for (size_t i = 0; i < count; i++) {
+            if (ids[i] == id)
+                return true;
+        }
+
+        return false;
+    }
+
+    uint64_t SnapshotHistory::next_id(uint64_t now) const
+    {
+        if (count > 0 && now < ids[count - 1] + ID_GAP)
+            return ids[count - 1] + ID_GAP;
+
+        return now;
+    }
+
+    SnapshotHistory::Index& SnapshotHistory::index(size_t i)
+    {
+        if (slots[i] != nullptr)
+            return *slots[i];
+
+        slots[i] = construct_at<Index>(
+          SquidSnapshot::squidutils->_heap.alloc(sizeof(Index)));
+
+        Path snapshot = to_path(ids[i]);
+
+        // INFO: One listing per L2 directory, the only time the directories
+        // of a completed snapshot are scanned.
+        Storage& storage = SquidSnapshot::squidutils->_storage;
+
+        for (uint64_t l1 = 0; l1 < ROOT_SIZE; l1++) {
+            for (uint64_t l2 = 0; l2 < L1_SIZE; l2++) {
+                Path dir(snapshot, "/", l1, "/", l2);
+
+                storage.for_each_entry(dir, [&](char const* name, bool is_dir) {
+                    if (is_dir)
+                        return;
+
+                    uint64_t file = 0;
+                    if (ascii_to(name, file) != Genode::strlen(name) ||
+                        file >= L2_SIZE)
+                        return;
+
+                    slots[i]->files.set(
+                      (l1 * L1_SIZE + l2) * L2_SIZE + file, 1);
+                });
+            }
+        }
+
+        HotPack::Header header{};
+        if (HotPack::load(snapshot, header)) {
+            for (uint64_t slot = 0; slot < HASH_COUNT; slot++) {
+                if (header.entries[slot] != 0)
+                    slots[i]->packed.set(slot, 1);
+            }
+        }
+
+        return *slots[i];
+    }
+
+    bool SnapshotHistory::has(uint64_t id, uint64_t slot)
+    {
+        for (size_t i = 0; i < count; i++) {
+            if (ids[i] == id)
+                return index(i).has(slot);
+        }
+
+        return false;
+    }
+
+    bool SnapshotHistory::is_packed(uint64_t id, uint64_t slot)
+    {
+        for (size_t i = 0; i < count; i++) {
+            if (ids[i] == id)
+                return index(i).packed.get(slot, 1);
+        }
+
+        return false;
+    }
+
+    bool SnapshotHistory::newest_with(uint64_t slot,
+                                      uint64_t& id,
+                                      uint64_t as_of)
+    {
+        for (size_t i = count; i-- > 0;) {
+            if (ids[i] > as_of)
+                continue;
+
+            if (index(i).has(slot)) {
+                id = ids[i];
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    size_t SnapshotHistory::snapshots_with(uint64_t slot,
+                                           uint64_t* out,
+                                           size_t max)
+    {
+        size_t found = 0;
+
+        for (size_t i = 0; i < count; i++) {
+            if (!index(i).has(slot))
+                continue;
+
+            if (found < max)
+                out[found] = ids[i];
+
+            found++;
+        }
+
+        return found;
+    }
+
+    Path SnapshotHistory::to_path(uint64_t id)
+    {
+        Genode::String<1024> path("/", SQUIDROOT, "/", id);
+        return path;
+    }
+}; // namespace SquidSnapshot
@@ -0,0 +1,79 @@
+/*
+ * Out-of-line parts of the host stand-ins for the Genode utility headers
+ * (see include/).
+ */
+
+#include <base/log.h>
+#include <util/string.h>
+
+#include <stdio.h>
+
+namespace Genode {
+
+    void print(Output& out, char const* str)
+    {
+        out.out_string(str ? str : "<null>");
+    }
+
+    void print(Output& out, char c)
+    {
+        out.out_char(c);
+    }
+
+    void print(Output& out, bool value)
+    {
+        out.out_string(value ? "true" : "false");
+    }
+
+    void print(Output& out, void const* ptr)
+    {
+        char buf[2 + 16 + 1];
+        snprintf(buf, sizeof(buf), "%p", ptr);
+        out.out_string(buf);
+    }
+
+    void print(Output& out, long long value)
+    {
+        char buf[24];
+        snprintf(buf, sizeof(buf), "%lld", value);
+        out.out_string(buf);
+    }
+
+    void print(Output& out, unsigned long long value)
+    {
+        char buf[24];
+        snprintf(buf, sizeof(buf), "%llu", value);
+        out.out_string(buf);
+    }
+
+    void Number_of_bytes::print(Output& out) const
+    {
+        size_t const KB = 1024, MB = 1024 * KB, GB = 1024 * MB;
+
+        if (_n && _n % GB == 0)
+            Genode::print(out, _n / GB, "G");
+        else if (_n && _n % MB == 0)
+            Genode::print(out, _n / MB, "M");
+        else if (_n && _n % KB == 0)
+            Genode::print(out, _n / KB, "K");
+        else
+            Genode::print(out, _n);
+    }
+
+    void Log::_write(Type type, char const* line)
+    {
+        switch (type) {
+            case WARNING:
+                fprintf(stderr, "Warning: %s\n", line);
+                break;
+
+            case ERROR:
+                fprintf(stderr, "Error: %s\n", line);
+                break;
+
+            default:
+                fprintf(stdout, "%s\n", line);
+                break;
+        }
+    }
+};
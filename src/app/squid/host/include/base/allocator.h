@@ -0,0 +1,55 @@
+/*
+ * Host stand-in for Genode's <base/allocator.h>.
+ */
+
+#ifndef __HOST_BASE_ALLOCATOR_H
+#define __HOST_BASE_ALLOCATOR_H
+
+#include <base/stdint.h>
+
+namespace Genode {
+
+    class Deallocator
+    {
+      public:
+        virtual ~Deallocator(void) {}
+
+        virtual void free(void* addr, size_t size) = 0;
+    };
+
+    class Allocator : public Deallocator
+    {
+      public:
+        class Out_of_memory
+        {};
+
+        /**
+         * @throw Out_of_memory
+         */
+        virtual void* alloc(size_t size) = 0;
+    };
+
+    template<typename T>
+    void destroy(Deallocator& dealloc, T* obj)
+    {
+        if (obj == nullptr)
+            return;
+
+        obj->~T();
+        dealloc.free(obj, sizeof(T));
+    }
+};
+
+inline void*
+operator new(Genode::size_t size, Genode::Allocator& alloc)
+{
+    return alloc.alloc(size);
+}
+
+inline void*
+operator new[](Genode::size_t size, Genode::Allocator& alloc)
+{
+    return alloc.alloc(size);
+}
+
+#endif // __HOST_BASE_ALLOCATOR_H
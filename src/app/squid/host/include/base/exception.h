@@ -0,0 +1,13 @@
+/*
+ * Host stand-in for Genode's <base/exception.h>.
+ */
+
+#ifndef __HOST_BASE_EXCEPTION_H
+#define __HOST_BASE_EXCEPTION_H
+
+namespace Genode {
+    class Exception
+    {};
+};
+
+#endif // __HOST_BASE_EXCEPTION_H
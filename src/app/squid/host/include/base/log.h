@@ -0,0 +1,74 @@
+/*
+ * Host stand-in for Genode's <base/log.h>.
+ */
+
+#ifndef __HOST_BASE_LOG_H
+#define __HOST_BASE_LOG_H
+
+#include <base/output.h>
+
+namespace Genode {
+
+    class Log
+    {
+      public:
+        enum Type
+        {
+            LOG,
+            WARNING,
+            ERROR
+        };
+
+      private:
+        class Line : public Output
+        {
+          private:
+            char _buf[512];
+            size_t _len = 0;
+
+          public:
+            void out_char(char c) override
+            {
+                if (_len < sizeof(_buf) - 1)
+                    _buf[_len++] = c;
+            }
+
+            char const* string(void)
+            {
+                _buf[_len] = 0;
+                return _buf;
+            }
+        };
+
+        static void _write(Type type, char const* line);
+
+      public:
+        template<typename... ARGS>
+        static void output(Type type, ARGS&&... args)
+        {
+            Line line;
+            print(line, args...);
+            _write(type, line.string());
+        }
+    };
+
+    template<typename... ARGS>
+    void log(ARGS&&... args)
+    {
+        Log::output(Log::LOG, args...);
+    }
+
+    template<typename... ARGS>
+    void warning(ARGS&&... args)
+    {
+        Log::output(Log::WARNING, args...);
+    }
+
+    template<typename... ARGS>
+    void error(ARGS&&... args)
+    {
+        Log::output(Log::ERROR, args...);
+    }
+};
+
+#endif // __HOST_BASE_LOG_H
@@ -0,0 +1,76 @@
+/*
+ * Host stand-in for Genode's <base/output.h>.
+ */
+
+#ifndef __HOST_BASE_OUTPUT_H
+#define __HOST_BASE_OUTPUT_H
+
+#include <base/stdint.h>
+
+namespace Genode {
+
+    class Output
+    {
+      public:
+        virtual ~Output(void) {}
+
+        virtual void out_char(char c) = 0;
+
+        void out_string(char const* str, size_t n = ~0UL)
+        {
+            for (size_t i = 0; i < n && str[i] != 0; i++)
+                out_char(str[i]);
+        }
+    };
+
+    void print(Output& out, char const* str);
+    void print(Output& out, char c);
+    void print(Output& out, bool value);
+    void print(Output& out, void const* ptr);
+
+    void print(Output& out, long long value);
+    void print(Output& out, unsigned long long value);
+
+    inline void print(Output& out, signed char v) { print(out, (long long)v); }
+    inline void print(Output& out, short v) { print(out, (long long)v); }
+    inline void print(Output& out, int v) { print(out, (long long)v); }
+    inline void print(Output& out, long v) { print(out, (long long)v); }
+
+    inline void print(Output& out, unsigned char v)
+    {
+        print(out, (unsigned long long)v);
+    }
+
+    inline void print(Output& out, unsigned short v)
+    {
+        print(out, (unsigned long long)v);
+    }
+
+    inline void print(Output& out, unsigned v)
+    {
+        print(out, (unsigned long long)v);
+    }
+
+    inline void print(Output& out, unsigned long v)
+    {
+        print(out, (unsigned long long)v);
+    }
+
+    /**
+     * @brief Objects are printed via their print(Output&) member.
+     */
+    template<typename T>
+    void print(Output& out, T const& obj)
+    {
+        obj.print(out);
+    }
+
+    template<typename HEAD, typename... TAIL>
+    void print(Output& out, HEAD const& head, TAIL&&... tail)
+    {
+        print(out, head);
+        print(out, tail...);
+    }
+};
+
+#endif // __HOST_BASE_OUTPUT_H
@@ -0,0 +1,27 @@
+/*
+ * Host stand-in for Genode's <base/stdint.h>.
+ */
+
+#ifndef __HOST_BASE_STDINT_H
+#define __HOST_BASE_STDINT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Genode {
+    typedef ::int8_t int8_t;
+    typedef ::int16_t int16_t;
+    typedef ::int32_t int32_t;
+    typedef ::int64_t int64_t;
+
+    typedef ::uint8_t uint8_t;
+    typedef ::uint16_t uint16_t;
+    typedef ::uint32_t uint32_t;
+    typedef ::uint64_t uint64_t;
+
+    typedef unsigned long size_t;
+    typedef unsigned long addr_t;
+    typedef long off_t;
+};
+
+#endif // __HOST_BASE_STDINT_H
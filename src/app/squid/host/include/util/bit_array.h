@@ -0,0 +1,148 @@
+/*
+ * Host stand-in for Genode's <util/bit_array.h>. Like the original, set()
+ * and clear() throw if a bit in the range is already set or cleared.
+ */
+
+#ifndef __HOST_UTIL_BIT_ARRAY_H
+#define __HOST_UTIL_BIT_ARRAY_H
+
+#include <base/exception.h>
+#include <base/stdint.h>
+
+namespace Genode {
+
+    class Bit_array_base
+    {
+      public:
+        class Invalid_index_access : public Exception
+        {};
+        class Invalid_clear : public Exception
+        {};
+        class Invalid_set : public Exception
+        {};
+
+        static constexpr size_t BITS_PER_WORD = sizeof(addr_t) * 8;
+
+      private:
+        size_t _bit_cnt;
+        addr_t* _words;
+
+        void _check_range(addr_t index, addr_t width) const
+        {
+            if (index + width > _bit_cnt || index + width < index)
+                throw Invalid_index_access();
+        }
+
+        static addr_t _mask(addr_t index, addr_t width)
+        {
+            addr_t const shift = index % BITS_PER_WORD;
+
+            if (width >= BITS_PER_WORD)
+                return ~0UL << shift;
+
+            return ((1UL << width) - 1) << shift;
+        }
+
+        /**
+         * @brief Calls fn(word, mask) for each word covered by the range,
+         * stops early if fn returns true.
+         */
+        template<typename FN>
+        void _for_each(addr_t index, addr_t width, FN const& fn) const
+        {
+            while (width != 0) {
+                addr_t const offset = index % BITS_PER_WORD;
+                addr_t bits = BITS_PER_WORD - offset;
+                if (bits > width)
+                    bits = width;
+
+                if (fn(_words[index / BITS_PER_WORD], _mask(index, bits)))
+                    return;
+
+                index += bits;
+                width -= bits;
+            }
+        }
+
+        void _set(addr_t index, addr_t width, bool free)
+        {
+            _check_range(index, width);
+
+            _for_each(index, width, [&](addr_t& word, addr_t mask) {
+                if (free) {
+                    if ((word & mask) != mask)
+                        throw Invalid_clear();
+                    word &= ~mask;
+                } else {
+                    if (word & mask)
+                        throw Invalid_set();
+                    word |= mask;
+                }
+                return false;
+            });
+        }
+
+      public:
+        Bit_array_base(size_t bits, addr_t* words)
+          : _bit_cnt(bits)
+          , _words(words)
+        {
+            for (size_t i = 0; i < bits / BITS_PER_WORD; i++)
+                _words[i] = 0;
+        }
+
+        /**
+         * @brief Whether any bit in the range is set.
+         */
+        bool get(addr_t index, addr_t width) const
+        {
+            _check_range(index, width);
+
+            bool used = false;
+            _for_each(index, width, [&](addr_t const& word, addr_t mask) {
+                used = (word & mask) != 0;
+                return used;
+            });
+
+            return used;
+        }
+
+        void set(addr_t index, addr_t width) { _set(index, width, false); }
+        void clear(addr_t index, addr_t width) { _set(index, width, true); }
+    };
+
+    template<size_t BITS>
+    class Bit_array : public Bit_array_base
+    {
+      private:
+        static constexpr size_t _WORDS = BITS / BITS_PER_WORD;
+
+        static_assert(BITS % BITS_PER_WORD == 0,
+                      "Count of bits need to be word aligned!");
+
+        addr_t _array[_WORDS];
+
+      public:
+        Bit_array(void)
+          : Bit_array_base(BITS, _array)
+        {
+        }
+
+        Bit_array(Bit_array const& other)
+          : Bit_array_base(BITS, _array)
+        {
+            for (size_t i = 0; i < _WORDS; i++)
+                _array[i] = other._array[i];
+        }
+
+        Bit_array& operator=(Bit_array const& other)
+        {
+            for (size_t i = 0; i < _WORDS; i++)
+                _array[i] = other._array[i];
+
+            return *this;
+        }
+    };
+};
+
+#endif // __HOST_UTIL_BIT_ARRAY_H
@@ -0,0 +1,19 @@
+/*
+ * Host stand-in for Genode's <util/construct_at.h>.
+ */
+
+#ifndef __HOST_UTIL_CONSTRUCT_AT_H
+#define __HOST_UTIL_CONSTRUCT_AT_H
+
+#include <new>
+
+namespace Genode {
+
+    template<typename T, typename... ARGS>
+    static inline T* construct_at(void* at, ARGS&&... args)
+    {
+        return new (at) T(static_cast<ARGS&&>(args)...);
+    }
+};
+
+#endif // __HOST_UTIL_CONSTRUCT_AT_H
@@ -0,0 +1,85 @@
+/*
+ * Host stand-in for Genode's <util/reconstructible.h>.
+ */
+
+#ifndef __HOST_UTIL_RECONSTRUCTIBLE_H
+#define __HOST_UTIL_RECONSTRUCTIBLE_H
+
+#include <util/construct_at.h>
+
+namespace Genode {
+
+    /**
+     * @brief Object that is constructed and destructed in place, without
+     * dynamic memory.
+     */
+    template<typename MT>
+    class Reconstructible
+    {
+      private:
+        alignas(MT) char _space[sizeof(MT)];
+
+        bool _constructed = false;
+
+        MT* _ptr(void) { return reinterpret_cast<MT*>(_space); }
+        MT const* _const_ptr(void) const
+        {
+            return reinterpret_cast<MT const*>(_space);
+        }
+
+        Reconstructible(Reconstructible const&) = delete;
+        Reconstructible& operator=(Reconstructible const&) = delete;
+
+      protected:
+        struct Lazy
+        {};
+
+        Reconstructible(Lazy*) {}
+
+      public:
+        template<typename... ARGS>
+        Reconstructible(ARGS&&... args)
+        {
+            construct(static_cast<ARGS&&>(args)...);
+        }
+
+        ~Reconstructible(void) { destruct(); }
+
+        template<typename... ARGS>
+        void construct(ARGS&&... args)
+        {
+            destruct();
+            construct_at<MT>(_space, static_cast<ARGS&&>(args)...);
+            _constructed = true;
+        }
+
+        void destruct(void)
+        {
+            if (!_constructed)
+                return;
+
+            _ptr()->~MT();
+            _constructed = false;
+        }
+
+        bool constructed(void) const { return _constructed; }
+
+        MT* operator->(void) { return _ptr(); }
+        MT const* operator->(void) const { return _const_ptr(); }
+
+        MT& operator*(void) { return *_ptr(); }
+        MT const& operator*(void) const { return *_const_ptr(); }
+    };
+
+    template<typename MT>
+    class Constructible : public Reconstructible<MT>
+    {
+      public:
+        Constructible(void)
+          : Reconstructible<MT>((typename Reconstructible<MT>::Lazy*)nullptr)
+        {
+        }
+    };
+};
+
+#endif // __HOST_UTIL_RECONSTRUCTIBLE_H
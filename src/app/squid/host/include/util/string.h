@@ -0,0 +1,310 @@
+/*
+ * Host stand-in for Genode's <util/string.h>.
+ */
+
+#ifndef __HOST_UTIL_STRING_H
+#define __HOST_UTIL_STRING_H
+
+#include <base/output.h>
+#include <base/stdint.h>
+
+namespace Genode {
+
+    inline size_t strlen(char const* s)
+    {
+        size_t len = 0;
+        for (; s[len] != 0; len++)
+            ;
+        return len;
+    }
+
+    inline int strcmp(char const* s1, char const* s2, size_t len = ~0UL)
+    {
+        for (; *s1 && *s1 == *s2 && len; s1++, s2++, len--)
+            ;
+        return len ? *s1 - *s2 : 0;
+    }
+
+    inline void* memcpy(void* dst, void const* src, size_t size)
+    {
+        return __builtin_memcpy(dst, src, size);
+    }
+
+    inline void* memset(void* dst, int i, size_t size)
+    {
+        return __builtin_memset(dst, i, size);
+    }
+
+    inline int memcmp(void const* p0, void const* p1, size_t size)
+    {
+        return __builtin_memcmp(p0, p1, size);
+    }
+
+    inline bool is_digit(char c, bool hex = false)
+    {
+        if (hex && ((c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F')))
+            return true;
+
+        return c >= '0' && c <= '9';
+    }
+
+    inline unsigned digit(char c, bool hex = false)
+    {
+        if (hex && c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+
+        if (hex && c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+
+        return c - '0';
+    }
+
+    /**
+     * @brief Reads an unsigned number, hexadecimal if prefixed with "0x".
+     * @return Number of consumed characters.
+     */
+    template<typename T>
+    size_t ascii_to_unsigned(char const* s, T& result)
+    {
+        size_t i = 0;
+        bool hex = false;
+
+        if (s[0] == '0' && s[1] == 'x') {
+            hex = true;
+            i = 2;
+        }
+
+        T value = 0;
+        size_t const start = i;
+
+        for (; is_digit(s[i], hex); i++)
+            value = value * (hex ? 16 : 10) + digit(s[i], hex);
+
+        if (i == start)
+            return 0;
+
+        result = value;
+        return i;
+    }
+
+    template<typename T>
+    size_t ascii_to_signed(char const* s, T& result)
+    {
+        bool negative = s[0] == '-';
+
+        unsigned long long value = 0;
+        size_t i = ascii_to_unsigned(s + (negative ? 1 : 0), value);
+        if (i == 0)
+            return 0;
+
+        result = negative ? -(T)value : (T)value;
+        return i + (negative ? 1 : 0);
+    }
+
+    inline size_t ascii_to(char const* s, unsigned long long& result)
+    {
+        return ascii_to_unsigned(s, result);
+    }
+
+    inline size_t ascii_to(char const* s, unsigned long& result)
+    {
+        return ascii_to_unsigned(s, result);
+    }
+
+    inline size_t ascii_to(char const* s, unsigned& result)
+    {
+        return ascii_to_unsigned(s, result);
+    }
+
+    inline size_t ascii_to(char const* s, long& result)
+    {
+        return ascii_to_signed(s, result);
+    }
+
+    inline size_t ascii_to(char const* s, int& result)
+    {
+        return ascii_to_signed(s, result);
+    }
+
+    inline size_t ascii_to(char const* s, bool& result)
+    {
+        if (strcmp(s, "yes", 3) == 0 || strcmp(s, "true", 4) == 0) {
+            result = true;
+            return s[0] == 'y' ? 3 : 4;
+        }
+
+        if (strcmp(s, "no", 2) == 0 || strcmp(s, "false", 5) == 0) {
+            result = false;
+            return s[0] == 'n' ? 2 : 5;
+        }
+
+        return 0;
+    }
+
+    /**
+     * @brief Size in bytes, parsed with an optional K, M or G suffix.
+     */
+    class Number_of_bytes
+    {
+      private:
+        size_t _n;
+
+      public:
+        Number_of_bytes(void)
+          : _n(0)
+        {
+        }
+
+        Number_of_bytes(size_t n)
+          : _n(n)
+        {
+        }
+
+        operator size_t() const { return _n; }
+
+        void print(Output& out) const;
+    };
+
+    inline size_t ascii_to(char const* s, Number_of_bytes& result)
+    {
+        unsigned long long value = 0;
+
+        size_t i = ascii_to_unsigned(s, value);
+        if (i == 0)
+            return 0;
+
+        switch (s[i]) {
+            case 'G':
+                value *= 1024;
+                [[fallthrough]];
+            case 'M':
+                value *= 1024;
+                [[fallthrough]];
+            case 'K':
+                value *= 1024;
+                i++;
+                break;
+            default:
+                break;
+        }
+
+        result = Number_of_bytes((size_t)value);
+        return i;
+    }
+
+    class Cstring
+    {
+      private:
+        char const* _str;
+        size_t _len;
+
+        static size_t _init_length(char const* str, size_t max_len)
+        {
+            size_t len = 0;
+            for (; len < max_len && str[len] != 0; len++)
+                ;
+            return len;
+        }
+
+      public:
+        Cstring(char const* str)
+          : _str(str)
+          , _len(strlen(str))
+        {
+        }
+
+        Cstring(char const* str, size_t max_len)
+          : _str(str)
+          , _len(_init_length(str, max_len))
+        {
+        }
+
+        size_t length(void) const { return _len; }
+
+        void print(Output& out) const { out.out_string(_str, _len); }
+    };
+
+    /**
+     * @brief Fixed-capacity string. As on Genode, length() includes the
+     * terminating zero and the constructor prints all its arguments.
+     */
+    template<size_t CAPACITY>
+    class String
+    {
+      private:
+        char _buf[CAPACITY];
+        size_t _len;
+
+        class Local_output : public Output
+        {
+          private:
+            char* _buf;
+            size_t _num_chars = 0;
+
+          public:
+            Local_output(char* buf)
+              : _buf(buf)
+            {
+            }
+
+            void out_char(char c) override
+            {
+                if (_num_chars < CAPACITY - 1)
+                    _buf[_num_chars++] = c;
+            }
+
+            size_t num_chars(void) const { return _num_chars; }
+        };
+
+      public:
+        String(void)
+          : _len(0)
+        {
+            _buf[0] = 0;
+        }
+
+        template<typename T, typename... TAIL>
+        String(T const& arg, TAIL&&... args)
+        {
+            Local_output out(_buf);
+            Genode::print(out, arg, args...);
+
+            _len = out.num_chars() + 1;
+            _buf[_len - 1] = 0;
+        }
+
+        static constexpr size_t capacity(void) { return CAPACITY; }
+
+        size_t length(void) const { return _len; }
+
+        bool valid(void) const
+        {
+            return _len != 0 && _len <= CAPACITY && _buf[_len - 1] == 0;
+        }
+
+        char const* string(void) const { return valid() ? _buf : ""; }
+
+        bool operator==(char const* other) const
+        {
+            return strcmp(string(), other) == 0;
+        }
+
+        bool operator!=(char const* other) const { return !(*this == other); }
+
+        template<size_t N>
+        bool operator==(String<N> const& other) const
+        {
+            return strcmp(string(), other.string()) == 0;
+        }
+
+        template<size_t N>
+        bool operator!=(String<N> const& other) const
+        {
+            return !(*this == other);
+        }
+
+        void print(Output& out) const { Genode::print(out, string()); }
+    };
+};
+
+#endif // __HOST_UTIL_STRING_H
@@ -0,0 +1,34 @@
+/*
+ * Host entry point, runs the same test and benchmarks as the Genode
+ * component (squid_test_and_benchmark()) on top of the PosixBackend.
+ *
+ *   squid_bench [<root directory> [<config file>]]
+ */
+
+#include <benchmark.h>
+#include <posix_backend.h>
+#include <squid.h>
+
+#include <sys/stat.h>
+
+SquidSnapshot::SquidUtils* SquidSnapshot::squidutils = nullptr;
+SquidSnapshot::Main* SquidSnapshot::global_squid = nullptr;
+
+int
+main(int argc, char** argv)
+{
+    char const* root = argc > 1 ? argv[1] : "squid-data";
+    char const* config = argc > 2 ? argv[2] : nullptr;
+
+    ::mkdir(root, 0755);
+
+    static SquidSnapshot::PosixBackend backend(root, config);
+
+    static SquidSnapshot::SquidUtils local_utils(backend);
+    SquidSnapshot::squidutils = &local_utils;
+
+    static SquidSnapshot::Main local_squid(SquidSnapshot::squidutils);
+    SquidSnapshot::global_squid = &local_squid;
+
+    return squid_test_and_benchmark() ? 0 : 1;
+}
@@ -0,0 +1,278 @@
+#include "squid.h"
+#include "squidlib.h"
+
+#include <util/string.h>
+
+namespace SquidSnapshot {
+
+    namespace {
+        /* 8 bytes, including the terminating zero */
+        const char PACK_MAGIC[] = "SQDPACK";
+
+        unsigned popcount(uint8_t bits)
+        {
+            return (unsigned)__builtin_popcount(bits);
+        }
+
+        Classifier::Config clamp(Classifier::Config config)
+        {
+            if (config.hot > Classifier::WINDOW)
+                config.hot = Classifier::WINDOW;
+            if (config.cold > Classifier::WINDOW)
+                config.cold = Classifier::WINDOW;
+
+            return config;
+        }
+    }
+
+    Classifier::Classifier(Config const& config, SnapshotHistory& history)
+      : config(clamp(config))
+      , history(history)
+    {
+        for (uint64_t slot = 0; slot < HASH_COUNT; slot++)
+            slots[slot] = Slot{ 0, false, false, false, false };
+    }
+
+    void Classifier::scan(void)
+    {
+        // INFO: The only full walk of the history, from here on the slots
+        // are kept up to date by advance() and note_stored().
+        for (uint64_t slot = 0; slot < HASH_COUNT; slot++) {
+            uint64_t id = 0;
+            slots[slot].stored = history.newest_with(slot, id);
+        }
+
+        observed = 0;
+
+        for (size_t i = history.size(); i-- > 0 && observed < WINDOW;) {
+            for (uint64_t slot = 0; slot < HASH_COUNT; slot++) {
+                if (history.has(history.at(i), slot))
+                    slots[slot].history |= (uint8_t)(1 << observed);
+            }
+
+            observed++;
+        }
+
+        classify_all();
+    }
+
+    void Classifier::set_config(Config const& config)
+    {
+        this->config = clamp(config);
+        classify_all();
+    }
+
+    void Classifier::forget(uint64_t slot)
+    {
+        slots[slot].history = 0;
+        slots[slot].written = false;
+
+        classify(slot);
+    }
+
+    void Classifier::note_stored(uint64_t slot)
+    {
+        slots[slot].stored = true;
+        classify(slot);
+    }
+
+    void Classifier::advance(void)
+    {
+        for (uint64_t slot = 0; slot < HASH_COUNT; slot++) {
+            slots[slot].history =
+              (uint8_t)((slots[slot].history << 1) | slots[slot].written);
+            slots[slot].stored |= slots[slot].written;
+            slots[slot].written = false;
+        }
+
+        if (observed < WINDOW)
+            observed++;
+
+        classify_all();
+    }
+
+    void Classifier::classify(uint64_t slot)
+    {
+        Slot& s = slots[slot];
+
+        stats.hot -= s.hot;
+        stats.cold -= s.cold;
+
+        s.hot = config.hot != 0 && popcount(s.history) >= config.hot;
+
+        // INFO: A hash that was never snapshotted is not cold, its page
+        // still has to be written once.
+        uint8_t const cold_mask = (uint8_t)((1U << config.cold) - 1);
+
+        s.cold = config.cold != 0 && observed >= config.cold &&
+                 (s.history & cold_mask) == 0 && s.stored;
+
+        stats.hot += s.hot;
+        stats.cold += s.cold;
+    }
+
+    void Classifier::classify_all(void)
+    {
+        for (uint64_t slot = 0; slot < HASH_COUNT; slot++)
+            classify(slot);
+    }
+
+    Classifier::Class Classifier::class_of(uint64_t slot) const
+    {
+        if (slots[slot].hot)
+            return HOT;
+
+        if (slots[slot].cold && !slots[slot].written)
+            return COLD;
+
+        return WARM;
+    }
+
+    Path HotPack::to_path(Path const& snapshot)
+    {
+        Genode::String<1024> path(snapshot, "/hot.pack");
+        return path;
+    }
+
+    void HotPack::reset(void)
+    {
+        header = Header{};
+
+        Genode::memcpy(header.magic, PACK_MAGIC, sizeof(header.magic));
+        header.version = VERSION;
+        header.record_size = RECORD_SIZE;
+
+        dirty = false;
+        stats.records = 0;
+    }
+
+    void HotPack::resume(Path const& current)
+    {
+        if (!load(current, header)) {
+            reset();
+            return;
+        }
+
+        dirty = false;
+        stats.records = 0;
+        for (uint64_t slot = 0; slot < HASH_COUNT; slot++) {
+            if (header.entries[slot] != 0)
+                stats.records++;
+        }
+    }
+
+    void HotPack::set_entry(uint64_t slot, uint32_t entry)
+    {
+        if (header.entries[slot] == entry)
+            return;
+
+        if (header.entries[slot] == 0)
+            stats.records++;
+        else if (entry == 0)
+            stats.records--;
+
+        header.entries[slot] = entry;
+        dirty = true;
+    }
+
+    Error HotPack::write(uint64_t slot, void const* data, size_t size)
+    {
+        if (size > RECORD_SIZE)
+            return Error::WriteFile;
+
+        Path path =
+          to_path(SquidSnapshot::global_squid->root_manager.to_path());
+
+        Error err = SquidSnapshot::squidutils->_storage.write_at(
+          path, offset(slot), data, size);
+
+        if (err != Error::None)
+            return err;
+
+        // INFO: The entry is only set once the record is complete.
+        set_entry(slot, (uint32_t)size + 1);
+
+        stats.writes++;
+        stats.bytes += size;
+
+        return Error::None;
+    }
+
+    Error HotPack::remove(uint64_t slot)
+    {
+        set_entry(slot, 0);
+        return Error::None;
+    }
+
+    Error HotPack::sync(void)
+    {
+        if (!dirty)
+            return Error::None;
+
+        Path path =
+          to_path(SquidSnapshot::global_squid->root_manager.to_path());
+
+        // INFO: A pack without records would only carry dead ones into the
+        // completed snapshot.
+        Error err = Error::None;
+        if (stats.records == 0)
+            err = SquidSnapshot::squidutils->remove(path);
+        else
+            err = SquidSnapshot::squidutils->_storage.write_at(
+              path, 0, &header, sizeof(header));
+
+        if (err == Error::None)
+            dirty = false;
+
+        return err;
+    }
+
+    bool HotPack::load(Path const& snapshot, Header& header)
+    {
+        size_t size = 0;
+
+        if (SquidSnapshot::squidutils->_storage.read_at(
+              to_path(snapshot), 0, &header, sizeof(header), size) !=
+              Error::None ||
+            size != sizeof(header))
+            return false;
+
+        if (Genode::memcmp(header.magic, PACK_MAGIC, sizeof(header.magic)))
+            return false;
+
+        return header.version == VERSION && header.record_size == RECORD_SIZE;
+    }
+
+    Error HotPack::read(Path const& snapshot,
+                        uint64_t slot,
+                        void* data,
+                        size_t capacity,
+                        size_t& size)
+    {
+        Storage& storage = SquidSnapshot::squidutils->_storage;
+        Path path = to_path(snapshot);
+
+        uint32_t entry = 0;
+        size_t read = 0;
+
+        if (storage.read_at(path,
+                            __builtin_offsetof(Header, entries) +
+                              slot * sizeof(entry),
+                            &entry,
+                            sizeof(entry),
+                            read) != Error::None ||
+            read != sizeof(entry) || entry == 0)
+            return Error::ReadFile;
+
+        size_t const file_size = entry - 1;
+        if (file_size > capacity || file_size > RECORD_SIZE)
+            return Error::CorruptedFile;
+
+        if (storage.read_at(path, offset(slot), data, file_size, size) !=
+              Error::None ||
+            size != file_size)
+            return Error::ReadFile;
+
+        return Error::None;
+    }
+}; // namespace SquidSnapshot
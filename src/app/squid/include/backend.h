@@ -0,0 +1,276 @@
+/**
+ * @Author Rumen Mitov
+ * @Date 2024-09-07
+
+ backend.h separates the squid core from the platform it runs on.
+
+ The core (trie, staging, scheduling, history, compaction, encryption) only
+ talks to the interfaces below. GenodeBackend implements them with the
+ Genode heap, VFS, timer and config ROM; PosixBackend with malloc, plain
+ files, clock_gettime and pthreads, so that the core can be built and
+ profiled natively on Linux (see host/).
+*/
+
+#ifndef __BACKEND_H
+#define __BACKEND_H
+
+#ifdef __cplusplus
+
+#include <base/allocator.h>
+#include <base/stdint.h>
+#include <util/string.h>
+
+namespace SquidSnapshot {
+    using namespace Genode;
+
+    /**
+     * @brief Error types associated with Squid Cache.
+     */
+    enum Error
+    {
+        OutOfHashes,
+	InvalidHash,
+        WriteFile,
+        ReadFile,
+        CreateFile,
+        CorruptedFile,
+        DeleteFile,
+        None
+    };
+
+    /**
+     * @brief Absolute path below the root of the backend's file system.
+     */
+    typedef String<256> Path;
+
+    /**
+     * @brief File system holding the squid root.
+     */
+    class Storage
+    {
+      public:
+        class Entry_handler
+        {
+          public:
+            virtual ~Entry_handler(void) {}
+            virtual void handle(char const* name, bool dir) = 0;
+        };
+
+        virtual ~Storage(void) {}
+
+        /**
+         * @brief Creates a directory, succeeds if it already exists.
+         */
+        virtual Error create_dir(Path const& path) = 0;
+
+        virtual bool directory_exists(Path const& path) = 0;
+        virtual bool file_exists(Path const& path) = 0;
+
+        /**
+         * @brief Replaces the file at path with size bytes of data.
+         * @return CreateFile if the file cannot be created, WriteFile if it
+         * cannot be written.
+         */
+        virtual Error write(Path const& path,
+                            void const* data,
+                            size_t size) = 0;
+
+        /**
+         * @brief Reads at most capacity bytes of the file at path.
+         * @param size Set to the number of bytes read.
+         */
+        virtual Error read(Path const& path,
+                           void* data,
+                           size_t capacity,
+                           size_t& size) = 0;
+
+        /**
+         * @brief Overwrites size bytes at offset of the file at path, which
+         * is created if it does not exist. The rest of the file is kept.
+         */
+        virtual Error write_at(Path const& path,
+                               uint64_t offset,
+                               void const* data,
+                               size_t size) = 0;
+
+        /**
+         * @brief Reads at most size bytes at offset of the file at path.
+         * @param read Set to the number of bytes read.
+         */
+        virtual Error read_at(Path const& path,
+                              uint64_t offset,
+                              void* data,
+                              size_t size,
+                              size_t& read) = 0;
+
+        virtual Error copy(Path const& from, Path const& to) = 0;
+
+        /**
+         * @brief Removes a file or an empty directory, succeeds if there is
+         * none.
+         */
+        virtual Error unlink(Path const& path) = 0;
+
+        virtual Error rename(Path const& from, Path const& to) = 0;
+
+        /**
+         * @brief Calls handler for each entry of the directory.
+         * @return false if the directory does not exist.
+         */
+        virtual bool list(Path const& path, Entry_handler& handler) = 0;
+
+        /**
+         * @brief Whether write() may be called for distinct files from
+         * several threads at once.
+         */
+        virtual bool concurrent(void) const { return false; }
+
+        template<typename FN>
+        bool for_each_entry(Path const& path, FN const& fn)
+        {
+            struct Handler : Entry_handler
+            {
+                FN const& fn;
+
+                Handler(FN const& fn)
+                  : fn(fn)
+                {
+                }
+
+                void handle(char const* name, bool dir) override
+                {
+                    fn(name, dir);
+                }
+            } handler{ fn };
+
+            return list(path, handler);
+        }
+    };
+
+    class Clock
+    {
+      public:
+        virtual ~Clock(void) {}
+
+        /**
+         * @brief Monotonic time since start-up.
+         */
+        virtual uint64_t elapsed_us(void) = 0;
+
+        /**
+         * @brief Wall-clock time, names the completed snapshots.
+         */
+        virtual uint64_t curr_time_us(void) = 0;
+
+        virtual void usleep(uint64_t us) = 0;
+    };
+
+    /**
+     * @brief Settings of the <config> node, e.g. <io bytes_per_sec="..."/>.
+     */
+    class ConfigSource
+    {
+      public:
+        typedef String<128> Value;
+
+        virtual ~ConfigSource(void) {}
+
+        virtual bool has_node(char const* node) = 0;
+
+        /**
+         * @brief Value of attribute attr of the sub node node.
+         * @return false if there is no such attribute.
+         */
+        virtual bool attribute(char const* node,
+                               char const* attr,
+                               Value& value) = 0;
+
+        /**
+         * @brief Copies up to size bytes of a named module (a ROM on Genode,
+         * a file on the host), e.g. the encryption key.
+         * @return Number of bytes copied, 0 if there is no such module.
+         */
+        virtual size_t module(char const* name, char* data, size_t size) = 0;
+    };
+
+    /**
+     * @brief Sequential byte stream, e.g. a file, or a File_system or
+     * Terminal session mounted into the VFS. Used to ship snapshots to
+     * another node (see SnapshotStream).
+     */
+    class Stream
+    {
+      public:
+        virtual ~Stream(void) {}
+
+        virtual Error write(void const* data, size_t size) = 0;
+
+        /**
+         * @brief Reads up to size bytes, fewer only at the end of the
+         * stream.
+         * @param read Set to the number of bytes read.
+         */
+        virtual Error read(void* data, size_t size, size_t& read) = 0;
+    };
+
+    /**
+     * @brief Threads of the ParallelWriter, each pinned to one CPU.
+     */
+    class WorkerPool
+    {
+      public:
+        class Task
+        {
+          public:
+            virtual ~Task(void) {}
+            virtual void run(unsigned worker) = 0;
+        };
+
+        virtual ~WorkerPool(void) {}
+
+        virtual unsigned size(void) = 0;
+
+        /**
+         * @brief Runs task on all workers in parallel and returns once
+         * every worker is done.
+         */
+        virtual void run(Task& task) = 0;
+
+        /**
+         * @brief Serializes the workers around state they share, e.g. the
+         * I/O scheduler.
+         */
+        virtual void lock(void) = 0;
+        virtual void unlock(void) = 0;
+    };
+
+    class Backend
+    {
+      public:
+        virtual ~Backend(void) {}
+
+        virtual Allocator& heap(void) = 0;
+        virtual Storage& storage(void) = 0;
+        virtual Clock& clock(void) = 0;
+        virtual ConfigSource& config(void) = 0;
+
+        virtual unsigned cpu_count(void) = 0;
+
+        /**
+         * @brief Opens path for writing (replacing its content) or reading.
+         * @return nullptr if it cannot be opened.
+         */
+        virtual Stream* open_stream(Path const& path, bool write) = 0;
+        virtual void close_stream(Stream* stream) = 0;
+
+        /**
+         * @brief Starts worker threads, pinned to the CPUs following cpu.
+         */
+        virtual WorkerPool* create_pool(unsigned workers, unsigned cpu) = 0;
+        virtual void destroy_pool(WorkerPool* pool) = 0;
+    };
+};
+
+#endif // __cplusplus
+
+#endif // __BACKEND_H
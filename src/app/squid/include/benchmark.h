@@ -12,4 +12,34 @@ struct big_data
 
 void squid_benchmark (void);
 
+/**
+ * @brief Compares write throughput of plaintext and encrypted squid files.
+ */
+void squid_benchmark_encryption (void);
+
+/**
+ * @brief Compares the time pages are locked while staging with the time it
+ * takes to drain them.
+ */
+void squid_benchmark_staging (void);
+
+/**
+ * @brief Compares encrypted write throughput with 1, 2 and 4 worker threads
+ * (as far as there are CPUs).
+ */
+void squid_benchmark_parallel (void);
+
+/**
+ * @brief Compares write throughput on a Zipfian workload with and without
+ * packing the hot hashes (see Classifier).
+ */
+void squid_benchmark_hotcold (void);
+
+/**
+ * @brief Runs the self tests and all benchmarks, then finishes the snapshot.
+ * Shared by the Genode component and the host build.
+ * @return false if a self test failed.
+ */
+bool squid_test_and_benchmark (void);
+
 #endif // __BENCHMARK_H
@@ -0,0 +1,114 @@
+/**
+ * @Author Rumen Mitov
+ * @Date 2024-09-07
+
+ crypto.h provides authenticated encryption (AES-128-GCM) for squid files.
+
+ On x86_64 CPUs with AES-NI and PCLMULQDQ the cipher runs on the hardware
+ instructions, otherwise it falls back to a portable implementation. Both
+ paths produce the same output, so snapshots can be moved between machines.
+
+ An encrypted squid file is laid out as:
+
+   <ciphertext> <key id (KEY_ID_SIZE bytes)> <nonce (NONCE_SIZE bytes)>
+   <tag (TAG_SIZE bytes)>
+
+ Every snapshot is sealed with a key of its own, derived from a master key
+ (see Cipher::derive()). The key id names the master key and the snapshot
+ key, so files stay readable after the master key is rotated as long as the
+ retired key is still configured. The slot of the hash and the key id are
+ authenticated along with the ciphertext, so files cannot be swapped between
+ hashes without being detected.
+*/
+
+#ifndef __CRYPTO_H
+#define __CRYPTO_H
+
+#ifdef __cplusplus
+
+#include <base/stdint.h>
+
+namespace SquidSnapshot {
+    using namespace Genode;
+
+    class Cipher
+    {
+      public:
+        static const size_t KEY_SIZE = 16;
+        static const size_t NONCE_SIZE = 12;
+        static const size_t TAG_SIZE = 16;
+
+        /**
+         * @brief Id of the master key (4 bytes) and number of the snapshot
+         * key derived from it (4 bytes), little endian.
+         */
+        static const size_t KEY_ID_SIZE = 8;
+
+        /**
+         * @brief Bytes an encrypted squid file carries on top of its payload.
+         */
+        static const size_t OVERHEAD = KEY_ID_SIZE + NONCE_SIZE + TAG_SIZE;
+
+      private:
+        static const size_t ROUNDS = 10;
+
+        alignas(16) uint8_t round_keys[(ROUNDS + 1) * 16];
+        alignas(16) uint8_t hash_key[16];
+
+        bool accelerated;
+
+        Cipher(const Cipher&) = delete;
+        Cipher& operator=(const Cipher&) = delete;
+
+      public:
+        Cipher(uint8_t const key[KEY_SIZE]);
+        ~Cipher(void);
+
+        /**
+         * @brief Whether the AES-NI/PCLMULQDQ path is in use.
+         */
+        bool is_accelerated(void) const { return accelerated; }
+
+        /**
+         * @brief Encrypts len bytes from src into dst (which may be src) and
+         * computes the tag over aad and the ciphertext.
+         */
+        void seal(uint8_t const nonce[NONCE_SIZE],
+                  uint8_t const* aad,
+                  size_t aad_len,
+                  uint8_t const* src,
+                  uint8_t* dst,
+                  size_t len,
+                  uint8_t tag[TAG_SIZE]);
+
+        /**
+         * @brief Decrypts len bytes from src into dst (which may be src).
+         * @return false if the tag does not match, dst is zeroed then.
+         */
+        bool open(uint8_t const nonce[NONCE_SIZE],
+                  uint8_t const* aad,
+                  size_t aad_len,
+                  uint8_t const* src,
+                  uint8_t* dst,
+                  size_t len,
+                  uint8_t const tag[TAG_SIZE]);
+
+        /**
+         * @brief Derives the snapshot key number of master key master_id by
+         * encrypting a single block that names both.
+         */
+        void derive(uint32_t master_id,
+                    uint32_t number,
+                    uint8_t key[KEY_SIZE]) const;
+
+        /**
+         * @brief Parses a key of 2 * KEY_SIZE hex digits.
+         * @return false if the string is not a valid key.
+         */
+        static bool parse_key(char const* hex, uint8_t key[KEY_SIZE]);
+    };
+};
+
+#endif // __cplusplus
+
+#endif // __CRYPTO_H
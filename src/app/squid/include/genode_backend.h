@@ -0,0 +1,221 @@
+/**
+ * @Author Rumen Mitov
+ * @Date 2024-09-07
+
+ genode_backend.h implements the squid backend (see backend.h) with the
+ Genode heap, VFS, timer session and config ROM.
+*/
+
+#ifndef __GENODE_BACKEND_H
+#define __GENODE_BACKEND_H
+
+#ifdef __cplusplus
+
+#include "backend.h"
+
+#include <base/attached_rom_dataspace.h>
+#include <base/component.h>
+#include <base/heap.h>
+#include <base/mutex.h>
+#include <base/semaphore.h>
+#include <base/thread.h>
+#include <os/vfs.h>
+#include <timer_session/connection.h>
+#include <util/reconstructible.h>
+#include <vfs/file_system_factory.h>
+
+namespace SquidSnapshot {
+
+    class GenodeBackend : public Backend
+    {
+      private:
+        class VfsStorage : public Storage
+        {
+          private:
+            Vfs::Simple_env& _vfs_env;
+            Root_directory& _root_dir;
+            Allocator& _heap;
+
+          public:
+            VfsStorage(Vfs::Simple_env& vfs_env,
+                       Root_directory& root_dir,
+                       Allocator& heap)
+              : _vfs_env(vfs_env)
+              , _root_dir(root_dir)
+              , _heap(heap)
+            {
+            }
+
+            Error create_dir(Path const& path) override;
+            bool directory_exists(Path const& path) override;
+            bool file_exists(Path const& path) override;
+            Error write(Path const& path,
+                        void const* data,
+                        size_t size) override;
+            Error read(Path const& path,
+                       void* data,
+                       size_t capacity,
+                       size_t& size) override;
+            Error write_at(Path const& path,
+                           uint64_t offset,
+                           void const* data,
+                           size_t size) override;
+            Error read_at(Path const& path,
+                          uint64_t offset,
+                          void* data,
+                          size_t size,
+                          size_t& read) override;
+            Error copy(Path const& from, Path const& to) override;
+            Error unlink(Path const& path) override;
+            Error rename(Path const& from, Path const& to) override;
+            bool list(Path const& path, Entry_handler& handler) override;
+        };
+
+        /**
+         * @brief File in the VFS, which may as well be a File_system or
+         * Terminal session mounted via the <fs/> or <terminal/> plugin.
+         */
+        class VfsStream : public Stream
+        {
+          private:
+            Constructible<New_file> _out{};
+            Constructible<Readonly_file> _in{};
+
+            Readonly_file::At _at{ 0 };
+
+          public:
+            /**
+             * @throw New_file::Create_failed, File::Open_failed
+             */
+            VfsStream(Root_directory& root_dir, Path const& path, bool write);
+
+            Error write(void const* data, size_t size) override;
+            Error read(void* data, size_t size, size_t& read) override;
+        };
+
+        class TimerClock : public Clock
+        {
+          private:
+            Timer::Connection& _timer;
+
+          public:
+            TimerClock(Timer::Connection& timer)
+              : _timer(timer)
+            {
+            }
+
+            uint64_t elapsed_us(void) override;
+            uint64_t curr_time_us(void) override;
+            void usleep(uint64_t us) override;
+        };
+
+        class RomConfig : public ConfigSource
+        {
+          private:
+            Env& _env;
+            Attached_rom_dataspace& _rom;
+
+          public:
+            RomConfig(Env& env, Attached_rom_dataspace& rom)
+              : _env(env)
+              , _rom(rom)
+            {
+            }
+
+            bool has_node(char const* node) override;
+            bool attribute(char const* node,
+                           char const* attr,
+                           Value& value) override;
+            size_t module(char const* name, char* data, size_t size) override;
+        };
+
+        class ThreadPool : public WorkerPool
+        {
+          private:
+            class Worker : public Genode::Thread
+            {
+              private:
+                Worker(const Worker&) = delete;
+                Worker& operator=(const Worker&) = delete;
+
+              public:
+                Genode::Semaphore start_sem{ 0 };
+                Genode::Semaphore done_sem{ 0 };
+
+                Task* task = nullptr;
+                unsigned index;
+
+                Worker(Env& env, unsigned index, Affinity::Location location);
+
+                void entry(void) override;
+            };
+
+            static const unsigned MAX_WORKERS = 16;
+
+            Allocator& _heap;
+
+            Worker* _workers[MAX_WORKERS];
+            unsigned _count;
+
+            Genode::Mutex _shared{};
+
+            ThreadPool(const ThreadPool&) = delete;
+            ThreadPool& operator=(const ThreadPool&) = delete;
+
+          public:
+            ThreadPool(Env& env,
+                       Allocator& heap,
+                       unsigned workers,
+                       unsigned cpu);
+            ~ThreadPool(void);
+
+            unsigned size(void) override { return _count; }
+            void run(Task& task) override;
+
+            void lock(void) override { _shared.acquire(); }
+            void unlock(void) override { _shared.release(); }
+        };
+
+        Env& _env;
+
+        Heap _heap{ _env.ram(), _env.rm() };
+        Attached_rom_dataspace _config{ _env, "config" };
+
+        Vfs::Simple_env _vfs_env{ _env, _heap, _config.xml().sub_node("vfs") };
+        Root_directory _root_dir{ _env, _heap, _config.xml().sub_node("vfs") };
+
+        Genode::Entrypoint _ep_timer{ _env,
+                                      sizeof(Genode::addr_t) * 2048,
+                                      "entrypoint_timer",
+                                      Genode::Affinity::Location() };
+
+        Timer::Connection _timer{ _env, _ep_timer, "squid_timer" };
+
+        VfsStorage _storage{ _vfs_env, _root_dir, _heap };
+        TimerClock _clock{ _timer };
+        RomConfig _rom_config{ _env, _config };
+
+      public:
+        GenodeBackend(Env& env)
+          : _env(env)
+        {
+        }
+
+        Allocator& heap(void) override { return _heap; }
+        Storage& storage(void) override { return _storage; }
+        Clock& clock(void) override { return _clock; }
+        ConfigSource& config(void) override { return _rom_config; }
+
+        unsigned cpu_count(void) override;
+
+        Stream* open_stream(Path const& path, bool write) override;
+        void close_stream(Stream* stream) override;
+
+        WorkerPool* create_pool(unsigned workers, unsigned cpu) override;
+        void destroy_pool(WorkerPool* pool) override;
+    };
+};
+
+#endif // __cplusplus
+
+#endif // __GENODE_BACKEND_H
@@ -0,0 +1,228 @@
+/**
+ * @Author Rumen Mitov
+ * @Date 2024-09-07
+
+ posix_backend.h implements the squid backend (see backend.h) on Linux, for
+ profiling the core with perf, sanitizers and microbenchmarks.
+
+ Squid paths are resolved below a host directory. The config is read from
+ a file holding the same <config> node as the Genode run script, of which
+ only the attributes of direct sub nodes are looked at.
+*/
+
+#ifndef __POSIX_BACKEND_H
+#define __POSIX_BACKEND_H
+
+#ifdef __cplusplus
+
+#include "backend.h"
+
+#include <pthread.h>
+
+namespace SquidSnapshot {
+
+    class PosixBackend : public Backend
+    {
+      public:
+        typedef String<512> Host_path;
+
+      private:
+        class MallocAllocator : public Allocator
+        {
+          public:
+            void* alloc(size_t size) override;
+            void free(void* addr, size_t size) override;
+        };
+
+        class FileStorage : public Storage
+        {
+          private:
+            Host_path _root;
+
+          public:
+            Host_path _host(Path const& path) const;
+
+            FileStorage(char const* root)
+              : _root(root)
+            {
+            }
+
+            Error create_dir(Path const& path) override;
+            bool directory_exists(Path const& path) override;
+            bool file_exists(Path const& path) override;
+            Error write(Path const& path,
+                        void const* data,
+                        size_t size) override;
+            Error read(Path const& path,
+                       void* data,
+                       size_t capacity,
+                       size_t& size) override;
+            Error write_at(Path const& path,
+                           uint64_t offset,
+                           void const* data,
+                           size_t size) override;
+            Error read_at(Path const& path,
+                          uint64_t offset,
+                          void* data,
+                          size_t size,
+                          size_t& read) override;
+            Error copy(Path const& from, Path const& to) override;
+            Error unlink(Path const& path) override;
+            Error rename(Path const& from, Path const& to) override;
+            bool list(Path const& path, Entry_handler& handler) override;
+
+            bool concurrent(void) const override { return true; }
+        };
+
+        class FileStream : public Stream
+        {
+          private:
+            int _fd;
+
+            FileStream(const FileStream&) = delete;
+            FileStream& operator=(const FileStream&) = delete;
+
+          public:
+            FileStream(int fd)
+              : _fd(fd)
+            {
+            }
+
+            ~FileStream(void);
+
+            Error write(void const* data, size_t size) override;
+            Error read(void* data, size_t size, size_t& read) override;
+        };
+
+        class MonotonicClock : public Clock
+        {
+          private:
+            uint64_t _start_us;
+
+          public:
+            MonotonicClock(void);
+
+            uint64_t elapsed_us(void) override;
+            uint64_t curr_time_us(void) override;
+            void usleep(uint64_t us) override;
+        };
+
+        class FileConfig : public ConfigSource
+        {
+          private:
+            static const size_t MAX_SIZE = 64 * 1024;
+
+            char* _xml;
+
+            /**
+             * @brief Start of the attributes of the sub node, nullptr if
+             * there is none.
+             */
+            char const* _node(char const* node) const;
+
+            FileConfig(const FileConfig&) = delete;
+            FileConfig& operator=(const FileConfig&) = delete;
+
+          public:
+            /**
+             * @param path File holding the <config> node, may be nullptr.
+             */
+            FileConfig(char const* path);
+            ~FileConfig(void);
+
+            bool has_node(char const* node) override;
+            bool attribute(char const* node,
+                           char const* attr,
+                           Value& value) override;
+            size_t module(char const* name, char* data, size_t size) override;
+        };
+
+        class PthreadPool : public WorkerPool
+        {
+          private:
+            static const unsigned MAX_WORKERS = 16;
+
+            struct Start
+            {
+                PthreadPool* pool;
+                unsigned index;
+            };
+
+            pthread_t _threads[MAX_WORKERS];
+            Start _starts[MAX_WORKERS];
+            unsigned _count;
+
+            pthread_mutex_t _mutex = PTHREAD_MUTEX_INITIALIZER;
+            pthread_mutex_t _shared = PTHREAD_MUTEX_INITIALIZER;
+            pthread_cond_t _start = PTHREAD_COND_INITIALIZER;
+            pthread_cond_t _done = PTHREAD_COND_INITIALIZER;
+
+            /**
+             * @brief Incremented by run() to start the workers.
+             */
+            uint64_t _round = 0;
+            unsigned _finished = 0;
+
+            Task* _task = nullptr;
+            bool _exit = false;
+
+            static void* _entry(void* arg);
+
+            void _work(unsigned index);
+
+            /**
+             * @brief Stops and joins the _count workers.
+             */
+            void _stop(void);
+
+            PthreadPool(const PthreadPool&) = delete;
+            PthreadPool& operator=(const PthreadPool&) = delete;
+
+          public:
+            PthreadPool(unsigned workers, unsigned cpu, unsigned cpus);
+            ~PthreadPool(void);
+
+            unsigned size(void) override { return _count; }
+            void run(Task& task) override;
+
+            void lock(void) override { ::pthread_mutex_lock(&_shared); }
+            void unlock(void) override { ::pthread_mutex_unlock(&_shared); }
+        };
+
+        MallocAllocator _heap{};
+        FileStorage _storage;
+        MonotonicClock _clock{};
+        FileConfig _config;
+
+      public:
+        /**
+         * @param root   Host directory holding the squid root.
+         * @param config File holding the <config> node, may be nullptr.
+         */
+        PosixBackend(char const* root, char const* config)
+          : _storage(root)
+          , _config(config)
+        {
+        }
+
+        Allocator& heap(void) override { return _heap; }
+        Storage& storage(void) override { return _storage; }
+        Clock& clock(void) override { return _clock; }
+        ConfigSource& config(void) override { return _config; }
+
+        unsigned cpu_count(void) override;
+
+        /**
+         * @brief Resolves path below the root, like the squid paths.
+         */
+        Stream* open_stream(Path const& path, bool write) override;
+        void close_stream(Stream* stream) override;
+
+        WorkerPool* create_pool(unsigned workers, unsigned cpu) override;
+        void destroy_pool(WorkerPool* pool) override;
+    };
+};
+
+#endif // __cplusplus
+
+#endif // __POSIX_BACKEND_H
@@ -27,15 +27,14 @@
 
 #ifdef __cplusplus
 
-#include <base/attached_rom_dataspace.h>
-#include <base/buffered_output.h>
-#include <base/component.h>
-#include <base/heap.h>
-#include <base/sleep.h>
-#include <os/vfs.h>
-#include <timer_session/connection.h>
+#include "backend.h"
+#include "crypto.h"
+
+#include <base/exception.h>
+#include <base/log.h>
 #include <util/bit_array.h>
-#include <vfs/file_system_factory.h>
+#include <util/reconstructible.h>
+#include <util/string.h>
 
 #define BITS_PER_WORD sizeof(addr_t) * 8UL
 #define WORD_ALIGN(_BITS) (BITS_PER_WORD) - (_BITS % (BITS_PER_WORD)) + _BITS
@@ -43,21 +42,6 @@
 namespace SquidSnapshot {
     using namespace Genode;
 
-    /**
-     * @brief Error types associated with Squid Cache.
-     */
-    enum Error
-    {
-        OutOfHashes,
-	InvalidHash,
-        WriteFile,
-        ReadFile,
-        CreateFile,
-        CorruptedFile,
-        DeleteFile,
-        None
-    };
-
     /**
      * @brief The root directory containing all snapshots.
      */
@@ -76,11 +60,30 @@ namespace SquidSnapshot {
     static const uint64_t L2_SIZE = 5;
     static const uint64_t __L2_SIZE = WORD_ALIGN(L2_SIZE);
 
+    /**
+     * @brief Total number of hashes in a snapshot. A hash's slot is its
+     * position in the trie when walked in directory order, i.e.
+     * (l1 * L1_SIZE + l2) * L2_SIZE + file_id.
+     */
+    static const uint64_t HASH_COUNT = ROOT_SIZE * L1_SIZE * L2_SIZE;
+    static const uint64_t __HASH_COUNT = WORD_ALIGN(HASH_COUNT);
+
+    /**
+     * @brief Largest payload that can be written to an encrypted squid file.
+     */
+    static const size_t MAX_PAYLOAD_SIZE = 4096;
+
+    /**
+     * @brief Default capacity of the staging ring, see StagingRing.
+     */
+    static const size_t STAGING_SIZE = 4 * 1024 * 1024;
+
     struct Main;
     class SnapshotRoot;
     class L1Dir;
     class L2Dir;
     class SquidFileHash;
+    class StagingRing;
 
     /**
      * @brief Manages L1 directories in the snapshot root.
@@ -95,17 +98,52 @@ namespace SquidSnapshot {
         SnapshotRoot(const SnapshotRoot&) = delete;
         SnapshotRoot& operator=(const SnapshotRoot&) = delete;
 
+        L2Dir* _dir_of(uint64_t slot);
+
       public:
         SnapshotRoot();
         ~SnapshotRoot(void);
 
-        Genode::Directory::Path to_path(void);
+        Path to_path(void);
         bool is_full(void);
 
         L1Dir* get_entry(void);
         void return_entry(uint64_t);
 
+        /**
+         * @brief Clears the bit of an L1 directory that ran out of free
+         * hashes outside of get_entry().
+         */
+        void mark_full(uint64_t);
+
         SquidFileHash* get_hash(void);
+
+        /**
+         * @brief Acquires a hash placed near the given key. Consecutive
+         * keys (e.g. page frame numbers) map to ascending file ids in the
+         * same L2 directory, so that writes and restores walk the trie in
+         * directory order. Falls back to get_hash() if the neighbourhood
+         * of the key is exhausted.
+         */
+        SquidFileHash* get_hash_near(uint64_t key);
+
+        /**
+         * @brief Returns the hash in the given slot, allocating it if it is
+         * free or reserved, e.g. to reach hashes imported from another
+         * node. Returns nullptr if the hash is already handed out.
+         */
+        SquidFileHash* hash_at(uint64_t slot);
+
+        /**
+         * @brief Allocates the hash in the given slot for hash_at(), so
+         * that get_hash() does not hand it out in the meantime.
+         */
+        void reserve(uint64_t slot);
+
+        /**
+         * @brief Whether the hash in the given slot is handed out.
+         */
+        bool is_taken(uint64_t slot);
     };
 
     /**
@@ -129,11 +167,19 @@ namespace SquidSnapshot {
         L1Dir(SnapshotRoot*, uint64_t);
         ~L1Dir(void);
 
-        Genode::Directory::Path to_path(void);
+        Path to_path(void);
         bool is_full(void);
 
         L2Dir* get_entry(void);
+        L2Dir* entry_at(uint64_t);
         void return_entry(uint64_t);
+
+        /**
+         * @brief Clears the bit of an L2 directory that ran out of free
+         * hashes outside of get_entry(), and tells the root once this
+         * directory is full as well.
+         */
+        void mark_full(uint64_t);
     };
 
     /**
@@ -145,6 +191,7 @@ namespace SquidSnapshot {
         SquidFileHash* freelist = nullptr;
         uint64_t freeindex;
         Genode::Bit_array<__L2_SIZE> freemask;
+        Genode::Bit_array<__L2_SIZE> reserved;
 
         uint64_t l1_dir;
         uint64_t l2_dir;
@@ -154,14 +201,39 @@ namespace SquidSnapshot {
         L2Dir(const L2Dir&) = delete;
         L2Dir& operator=(const L2Dir&) = delete;
 
+        SquidFileHash* _take(uint64_t);
+
       public:
         L2Dir(L1Dir*, uint64_t l1, uint64_t l2);
         ~L2Dir(void);
 
-        Genode::Directory::Path to_path(void);
+        Path to_path(void);
         bool is_full(void);
 
         SquidFileHash* get_entry(void);
+
+        /**
+         * @brief Returns the first free hash with a file id not lower than
+         * the given one, or nullptr if there is none.
+         */
+        SquidFileHash* get_entry_near(uint64_t);
+
+        /**
+         * @brief Returns the hash with the given file id, allocating it if
+         * it is free or reserved, nullptr if it is already handed out.
+         */
+        SquidFileHash* entry_at(uint64_t);
+
+        /**
+         * @brief Allocates the hash with the given file id without handing
+         * it out, entry_at() does so later.
+         */
+        void reserve(uint64_t);
+
+        /**
+         * @brief Whether the hash with the given file id is handed out.
+         */
+        bool is_taken(uint64_t);
         void return_entry(uint64_t);
     };
 
@@ -180,6 +252,48 @@ namespace SquidSnapshot {
 
         L2Dir* parent;
 
+        /**
+         * @brief Incremented whenever the hash is returned, so that payloads
+         * staged for a previous owner of the slot are never written.
+         */
+        uint32_t generation = 0;
+
+        /**
+         * @brief Number of payloads of this hash waiting in the staging ring
+         * or a parallel writer.
+         */
+        uint32_t staged = 0;
+
+        /**
+         * @brief Size of the last squid file written, and Main::epoch at the
+         * time, i.e. whether the file is in the current snapshot.
+         */
+        uint32_t file_size = 0;
+        uint32_t file_epoch = 0;
+
+        friend class StagingRing;
+        friend class ParallelWriter;
+        friend class Reclaimer;
+
+        /**
+         * @brief Reads the payload as stored in a snapshot.
+         * @param packed Whether the snapshot holds it in its HotPack.
+         */
+        enum Error read_from(Path const& snapshot, bool packed, void* payload);
+
+        /**
+         * @brief Reads and authenticates an encrypted squid file.
+         */
+        enum Error read_encrypted(Path const& snapshot,
+                                  bool packed,
+                                  void* payload);
+
+        /**
+         * @brief Accounts a squid file of size bytes written to the current
+         * snapshot.
+         */
+        void wrote(size_t size);
+
         SquidFileHash(const SquidFileHash&) = delete;
         SquidFileHash& operator=(const SquidFileHash&) = delete;
 
@@ -191,47 +305,1114 @@ namespace SquidSnapshot {
 
         SquidFileHash(L2Dir*, uint64_t, uint64_t, uint64_t);
 
-        Genode::Directory::Path to_path(void);
+        Path to_path(void);
+
+        /**
+         * @brief Path of the squid file within a completed snapshot.
+         */
+        Path to_path(Path const& snapshot);
+
+        /**
+         * @brief Position of the hash in the trie (see HASH_COUNT).
+         */
+        uint64_t slot(void);
 
         /**
          * @brief Writes payload to file (creates one if it does not exist).
+         * Payloads of this hash still in the staging ring are drained first,
+         * so they cannot overwrite newer data.
          */
         enum Error write(void* payload, size_t size);
 
+        /**
+         * @brief Writes payload to file, bypassing the staging ring.
+         */
+        enum Error write_file(void const* payload, size_t size);
+
+        /**
+         * @brief Writes data to file as is, i.e. already encrypted if
+         * encryption is enabled.
+         */
+        enum Error write_raw(void const* data, size_t size);
+
         /**
          * @brief Reads from squid file into payload buffer.
          */
         enum Error read(void* payload);
 
+        /**
+         * @brief Reads the payload the hash had when the completed snapshot
+         * with the given id was taken.
+         */
+        enum Error read_at(uint64_t snapshot, void* payload);
+
         /**
          * @brief Returns hash back to L2 parent, and invalidates this object.
          */
         void return_entry(void);
     };
 
-    typedef Directory::Path Path;
+    /**
+     * @brief Captures payloads in memory so that virtual memory pages only
+     * stay locked for the duration of a memcpy.
+     *
+     * Staged payloads are written to their squid files by drain(), which
+     * runs after the page locks have been released (and at the latest in
+     * Main::finish()). The ring is a single preallocated buffer of entries:
+     *
+     *   <entry header> <payload, padded to 16 bytes> <entry header> ...
+     *
+     * If the ring is full, stage() writes the payload synchronously, so
+     * staging never fails for lack of space. Such overflows are counted in
+     * the statistics.
+     */
+    class StagingRing
+    {
+      public:
+        struct Stats
+        {
+            uint64_t capacity;
+            uint64_t used;
+            uint64_t high_water;
+            uint64_t entries;
+            uint64_t staged_bytes;
+            uint64_t drained_bytes;
+            uint64_t drain_us;
+            uint64_t overflows;
+            uint64_t dropped;
+        };
+
+      private:
+        struct Entry
+        {
+            SquidFileHash* hash; /* nullptr marks a wrap to offset 0 */
+            uint32_t generation;
+            uint32_t size;
+        };
+
+        uint8_t* buffer = nullptr;
+        size_t capacity;
+
+        size_t head = 0;
+        size_t tail = 0;
+        size_t used = 0;
+
+        Stats stats{};
+
+        StagingRing(const StagingRing&) = delete;
+        StagingRing& operator=(const StagingRing&) = delete;
+
+        static size_t entry_size(size_t payload)
+        {
+            return sizeof(Entry) + ((payload + 15) & ~(size_t)15);
+        }
+
+        Entry* reserve(size_t need);
+        Entry* front(void);
+
+      public:
+        StagingRing(size_t capacity);
+        ~StagingRing(void);
+
+        /**
+         * @brief Copies payload into the ring and returns immediately.
+         */
+        enum Error stage(SquidFileHash* hash, void const* payload, size_t size);
+
+        /**
+         * @brief Writes staged payloads in the order they were staged.
+         * @param budget bytes of payload to drain, 0 drains everything.
+         * @return First error encountered, the failed entry is dropped.
+         */
+        enum Error drain(size_t budget = 0);
+
+        bool is_empty(void) const { return stats.entries == 0; }
+
+        Stats const& statistics(void) const { return stats; }
+    };
+
+    /**
+     * @brief Bounds the impact of snapshot I/O on foreground workloads
+     * sharing the block device.
+     *
+     * Writes pass through two token buckets, one for bytes and one for
+     * operations per second. On top of that, if the write latency (moving
+     * average) exceeds the configured target, the scheduler backs off by
+     * idling for (2^level - 1) times the latency after every write, i.e.
+     * squid only uses 1/2^level of the device time. The level decreases
+     * again once the latency drops below half the target.
+     *
+     * Urgent mode (e.g. for shutdown snapshots) bypasses all limits.
+     */
+    class IoScheduler
+    {
+      public:
+        struct Config
+        {
+            uint64_t bytes_per_sec; /* 0 is unlimited */
+            uint64_t ops_per_sec;   /* 0 is unlimited */
+            uint64_t latency_us;    /* 0 disables the backoff */
+        };
+
+        struct Stats
+        {
+            uint64_t ops;
+            uint64_t bytes;
+            uint64_t throttled_us;
+            uint64_t latency_us;
+            uint64_t backoff;
+        };
+
+      private:
+        static const uint64_t MAX_BACKOFF = 4;
+
+        /**
+         * @brief How often the backoff level may change.
+         */
+        static const uint64_t ADJUST_US = 100 * 1000;
+
+        Config config;
+        Stats stats{};
+
+        bool urgent = false;
+
+        int64_t byte_tokens = 0;
+        int64_t op_tokens = 0;
+
+        /**
+         * @brief Fractions of a token, in millionths, carried over to the
+         * next refill.
+         */
+        uint64_t byte_remainder = 0;
+        uint64_t op_remainder = 0;
+
+        uint64_t last_refill_us = 0;
+        uint64_t last_adjust_us = 0;
+
+        void refill(uint64_t now);
+        void idle(uint64_t us);
+
+      public:
+        IoScheduler(Config const&);
+
+        /**
+         * @brief Blocks until a write of the given size may be issued.
+         * @return Start time of the write, to be passed to complete().
+         */
+        uint64_t admit(size_t bytes);
+
+        /**
+         * @brief Accounts the latency of a write started at admit().
+         */
+        void complete(uint64_t start);
+
+        void set_urgent(bool enable) { urgent = enable; }
+        bool is_urgent(void) const { return urgent; }
+
+        Stats const& statistics(void) const { return stats; }
+    };
+
+    /**
+     * @brief Path of the squid file of the given slot within a snapshot.
+     */
+    Path hash_path(Path const& snapshot, uint64_t slot);
+
+    /**
+     * @brief Completed snapshots, i.e. the numeric directories in
+     * /<squidroot>, ordered from oldest to newest.
+     *
+     * Snapshots are incremental: a snapshot only contains the squid files
+     * written while it was current. The data of a hash as of a snapshot is
+     * therefore found in the newest snapshot up to it that has a file for
+     * the hash.
+     *
+     * Completed snapshots never change, so the set of hashes each of them
+     * holds is indexed in memory. The index of a snapshot is built from its
+     * directories on first use, all further lookups are served from memory.
+     */
+    class SnapshotHistory
+    {
+      public:
+        static const size_t MAX_SNAPSHOTS = 256;
+        static const uint64_t ID_GAP = 1000;
+
+      private:
+        typedef Genode::Bit_array<__HASH_COUNT> Slots;
+
+        struct Index
+        {
+            Slots files;
+            Slots packed; /* held by the snapshot's HotPack */
+
+            bool has(uint64_t slot) const
+            {
+                return files.get(slot, 1) || packed.get(slot, 1);
+            }
+        };
+
+        uint64_t ids[MAX_SNAPSHOTS];
+        Index* slots[MAX_SNAPSHOTS];
+        size_t count = 0;
+
+        /**
+         * @brief Hashes held by the snapshot at index, built on first use.
+         */
+        Index& index(size_t i);
+
+      public:
+        /**
+         * @brief Reads the completed snapshots from disk.
+         */
+        void scan(void);
+
+        bool add(uint64_t id);
+        void remove(uint64_t id);
+        bool contains(uint64_t id) const;
+
+        /**
+         * @brief Id of a snapshot completed at time now, in microseconds.
+         *
+         * The clock may restart, e.g. on Genode with every boot, while
+         * lookups rely on ids growing with time. Ids thus always exceed the
+         * newest completed snapshot, the last id being kept on disk as its
+         * directory name. They keep a gap of ID_GAP to it, for the ids
+         * compaction gives merged snapshots (newest in range + 1).
+         */
+        uint64_t next_id(uint64_t now) const;
+
+        size_t size(void) const { return count; }
+        uint64_t at(size_t index) const { return ids[index]; }
+
+        /**
+         * @brief Whether snapshot id has a file for slot.
+         */
+        bool has(uint64_t id, uint64_t slot);
+
+        /**
+         * @brief Whether the file of slot in snapshot id is in its HotPack.
+         */
+        bool is_packed(uint64_t id, uint64_t slot);
+
+        /**
+         * @brief Finds the newest snapshot, not newer than as_of, that has a
+         * file for slot.
+         * @return false if no snapshot has one.
+         */
+        bool newest_with(uint64_t slot, uint64_t& id, uint64_t as_of = ~0ULL);
+
+        /**
+         * @brief Lists the snapshots that have a file for slot, oldest first.
+         * @return Number of snapshots, which may exceed max.
+         */
+        size_t snapshots_with(uint64_t slot, uint64_t* out, size_t max);
+
+        static Path to_path(uint64_t id);
+    };
+
+    /**
+     * @brief Merges a range of completed snapshots into one self-contained
+     * snapshot, keeping only the newest version of each hash.
+     *
+     * The merged snapshot is written in hash order into /<squidroot>/compact
+     * and renamed to <newest id in range> + 1 once complete. The rename is
+     * atomic, and since the merged snapshot holds the newest version of every
+     * hash in the range, lookups return the same data before and after it.
+     * The merged snapshots are removed afterwards.
+     *
+     * All work is done in step(), which is bounded by a budget of squid
+     * files, so compaction never blocks the snapshot for long.
+     */
+    class Compactor
+    {
+      private:
+        enum State
+        {
+            IDLE,
+            CLEARING,
+            COPYING,
+            REMOVING
+        };
+
+        State state = IDLE;
+
+        uint64_t ids[SnapshotHistory::MAX_SNAPSHOTS];
+        size_t count = 0;
+
+        uint64_t merged_id = 0;
+
+        /* position within the current state, see step() */
+        uint64_t cursor = 0;
+        size_t removing = 0;
+
+        /**
+         * @brief Removes the files and directories of a snapshot tree.
+         * @return true once the whole tree is gone.
+         */
+        bool remove_tree(Path const& root, uint64_t& budget);
+        Error copy(uint64_t& budget);
+        Error copy_packed(Path const& snapshot, uint64_t slot);
+        Error swap(void);
+
+      public:
+        /**
+         * @brief Starts merging the completed snapshots with ids in [from, to].
+         * Does nothing if there are fewer than two of them.
+         * @return false if a compaction is already running.
+         */
+        bool start(uint64_t from, uint64_t to);
+
+        /**
+         * @brief Continues the compaction, touching at most budget files.
+         */
+        Error step(uint64_t budget);
+
+        bool is_running(void) const { return state != IDLE; }
+
+        /**
+         * @brief Estimate of the squid files left to process.
+         */
+        uint64_t remaining(void) const;
+
+        static Path to_path(void);
+    };
+
+    /**
+     * @brief Tracks how often each hash is written across snapshots.
+     *
+     * Each hash has a history of the last WINDOW snapshots, one bit per
+     * snapshot that wrote it. The classes only change when a snapshot
+     * finishes, so that a hash is stored the same way for the whole of a
+     * snapshot:
+     *
+     *   hot  - written in at least `hot` of the last WINDOW snapshots, is
+     *          stored in the snapshot's HotPack.
+     *   cold - not written in the last `cold` snapshots, but held by an
+     *          older one. The kernel may skip dirty-checking such pages.
+     *   warm - everything else, stored as one squid file per hash.
+     *
+     * On start-up the histories are rebuilt from the completed snapshots.
+     */
+    class Classifier
+    {
+      public:
+        static const unsigned WINDOW = 8;
+
+        enum Class
+        {
+            COLD,
+            WARM,
+            HOT
+        };
+
+        struct Config
+        {
+            unsigned hot;  /* 0 disables the HotPack */
+            unsigned cold; /* 0 disables the cold class */
+        };
+
+        struct Stats
+        {
+            uint64_t hot;
+            uint64_t cold;
+        };
+
+      private:
+        struct Slot
+        {
+            uint8_t history; /* bit 0 is the newest completed snapshot */
+            bool written;    /* in the current snapshot */
+            bool stored;     /* in any completed snapshot */
+            bool hot;
+            bool cold;
+        };
+
+        Config config;
+        SnapshotHistory& history;
+
+        Slot slots[HASH_COUNT];
+
+        /**
+         * @brief Completed snapshots the histories cover, up to WINDOW.
+         */
+        unsigned observed = 0;
+
+        Stats stats{};
+
+        void classify(uint64_t slot);
+        void classify_all(void);
+
+      public:
+        Classifier(Config const&, SnapshotHistory&);
+
+        /**
+         * @brief Rebuilds the histories from the newest completed snapshots.
+         */
+        void scan(void);
+
+        void set_config(Config const& config);
+
+        void note_write(uint64_t slot) { slots[slot].written = true; }
+
+        /**
+         * @brief Records that a completed snapshot added outside of
+         * Main::finish(), e.g. an imported one, holds slot.
+         */
+        void note_stored(uint64_t slot);
+
+        /**
+         * @brief Clears the history of a deleted hash.
+         */
+        void forget(uint64_t slot);
+
+        /**
+         * @brief Shifts the histories once a snapshot finished.
+         */
+        void advance(void);
+
+        bool written(uint64_t slot) const { return slots[slot].written; }
+        bool is_hot(uint64_t slot) const { return slots[slot].hot; }
+
+        Class class_of(uint64_t slot) const;
+
+        Stats const& statistics(void) const { return stats; }
+    };
+
+    /**
+     * @brief Packed storage of the hot hashes of a snapshot, the file
+     * hot.pack in the snapshot's directory.
+     *
+     * A hot hash is written to a fixed record of the pack, overwriting its
+     * previous payload in place, instead of truncating and rewriting its
+     * own squid file. The header lists the records in use:
+     *
+     *   <header, HEADER_SIZE bytes> <record of slot 0> <record of slot 1> ...
+     *
+     * The header of the current pack is kept in memory and written by
+     * sync() only, i.e. whenever the payloads are flushed and before the
+     * snapshot completes, so that a write costs a single write of its
+     * record. Records written since the last sync are lost on a crash,
+     * just like staged payloads.
+     *
+     * The pack moves into the completed snapshot along with the squid
+     * files, a hash is held either by the pack or by a squid file of the
+     * snapshot, never by both.
+     */
+    class HotPack
+    {
+      public:
+        static const uint32_t VERSION = 1;
+
+        /**
+         * @brief Largest squid file held by a record, larger ones of hot
+         * hashes are written to their own squid files.
+         */
+        static const size_t RECORD_SIZE = MAX_PAYLOAD_SIZE + Cipher::OVERHEAD;
+
+        struct Header
+        {
+            char magic[8];
+            uint32_t version;
+            uint32_t record_size;
+
+            /* size of the squid file + 1, 0 if the record is not in use */
+            uint32_t entries[HASH_COUNT];
+        };
+
+        /**
+         * @brief Size of the header rounded up to a page, so that the
+         * records start page aligned for any HASH_COUNT.
+         */
+        static const size_t HEADER_SIZE =
+          (sizeof(Header) + 4095) & ~(size_t)4095;
+
+        struct Stats
+        {
+            uint64_t records;
+            uint64_t writes;
+            uint64_t bytes;
+        };
+
+      private:
+        /**
+         * @brief Header of the pack of the current snapshot.
+         */
+        Header header{};
+
+        /**
+         * @brief Whether header differs from the one in the pack.
+         */
+        bool dirty = false;
+
+        Stats stats{};
+
+        void set_entry(uint64_t slot, uint32_t entry);
+
+      public:
+        HotPack() { reset(); }
+
+        /**
+         * @brief Starts over with an empty pack for a new snapshot.
+         */
+        void reset(void);
+
+        /**
+         * @brief Takes over the pack a previous run left in the current
+         * snapshot, along with its squid files.
+         */
+        void resume(Path const& current);
+
+        bool contains(uint64_t slot) const
+        {
+            return header.entries[slot] != 0;
+        }
+
+        /**
+         * @brief Overwrites the record of slot in the current snapshot.
+         */
+        Error write(uint64_t slot, void const* data, size_t size);
+
+        /**
+         * @brief Drops the record of slot from the current snapshot.
+         */
+        Error remove(uint64_t slot);
+
+        /**
+         * @brief Writes the header of the current pack, if it changed.
+         */
+        Error sync(void);
+
+        Stats const& statistics(void) const { return stats; }
+
+        static Path to_path(Path const& snapshot);
+
+        static uint64_t offset(uint64_t slot)
+        {
+            return HEADER_SIZE + slot * RECORD_SIZE;
+        }
+
+        /**
+         * @brief Reads the header of the pack of a snapshot.
+         * @return false if the snapshot has no (valid) pack.
+         */
+        static bool load(Path const& snapshot, Header& header);
+
+        /**
+         * @brief Reads the squid file of slot from the pack of a snapshot.
+         */
+        static Error read(Path const& snapshot,
+                          uint64_t slot,
+                          void* data,
+                          size_t capacity,
+                          size_t& size);
+    };
+
+    /**
+     * @brief Reclaims the squid files of deleted hashes off the write path.
+     *
+     * A deleted hash is invalidated right away, but its slot is only
+     * returned to its L2 directory once its squid file has been dealt with
+     * in the current snapshot. Until then the slot is pending. step()
+     * reclaims pending slots one L2 directory at a time, so that the
+     * directory is touched once per batch, and Main::finish() reclaims all
+     * of them, so dead files never end up in a completed snapshot.
+     *
+     * If a completed snapshot holds the slot, an empty squid file is left
+     * in current as a tombstone, otherwise read() of the next owner would
+     * fall back to the deleted hash's data. read_at() of older snapshots is
+     * unaffected. Slots no completed snapshot holds only have their file
+     * unlinked, if one was written to current at all.
+     */
+    class Reclaimer
+    {
+      public:
+        struct Stats
+        {
+            uint64_t pending;
+            uint64_t dead_bytes; /* of the pending files */
+            uint64_t reclaimed;
+            uint64_t reclaimed_bytes;
+            uint64_t batches;
+        };
+
+      private:
+        static const uint64_t DIR_COUNT = ROOT_SIZE * L1_SIZE;
+
+        Genode::Bit_array<__HASH_COUNT> pending{};
+
+        /**
+         * @brief Pending slots with a squid file or record in current.
+         */
+        Genode::Bit_array<__HASH_COUNT> stored{};
+
+        SquidFileHash* hashes[HASH_COUNT];
+
+        /**
+         * @brief L2 directory the next batch starts at.
+         */
+        uint64_t cursor = 0;
+
+        Stats stats{};
+
+        /**
+         * @brief Reclaims at most budget pending slots of the L2 directory.
+         * @return First slot reclaimed.
+         */
+        uint64_t reclaim_dir(uint64_t dir, uint64_t& budget);
+
+        /**
+         * @brief Writes an empty squid file for slot to path.
+         */
+        Error tombstone(Path const& path, uint64_t slot);
+
+        Reclaimer(const Reclaimer&) = delete;
+        Reclaimer& operator=(const Reclaimer&) = delete;
+
+      public:
+        Reclaimer() {}
+
+        /**
+         * @brief Invalidates hash and queues its slot for reclamation.
+         */
+        enum Error defer(SquidFileHash* hash);
+
+        /**
+         * @brief Reclaims at most budget pending slots, 0 reclaims all.
+         */
+        void step(uint64_t budget = 0);
+
+        /**
+         * @brief Reclaims the next batch and allocates one of its slots, for
+         * when no free slots are left.
+         * @return nullptr if there are no pending slots.
+         */
+        SquidFileHash* take(void);
+
+        bool is_empty(void) const { return stats.pending == 0; }
+
+        Stats const& statistics(void) const { return stats; }
+    };
+
+    /**
+     * @brief Fans the writes of a snapshot out to worker threads, one per
+     * group of L1 subtrees (L1 directory index modulo the worker count).
+     *
+     * submit() only records the write. At the join point the workers copy
+     * (and encrypt, if enabled) the payloads of their subtrees into their
+     * own buffers in parallel, each pinned to its configured CPU. If the
+     * storage is concurrent (see Storage::concurrent()), each worker also
+     * writes the squid files of its subtrees, passing each write through
+     * the shared I/O scheduler under the pool's lock. Otherwise, e.g. on
+     * the Genode VFS, which dispatches its I/O signals on the entrypoint,
+     * the prepared files are written on the calling thread afterwards,
+     * subtree by subtree, in the order they were submitted. Records of the
+     * HotPack are always written on the calling thread.
+     *
+     * Payloads must stay valid (i.e. pages locked) until join() returns.
+     * Payloads of one hash should not be split between the staging ring
+     * and a parallel writer, since the ring is flushed first.
+     */
+    class ParallelWriter : private WorkerPool::Task
+    {
+      public:
+        static const unsigned MAX_WORKERS = 16;
+
+        struct Config
+        {
+            unsigned workers;  /* 0 disables the parallel mode */
+            unsigned cpu;      /* CPU of the first worker */
+            size_t buffer;     /* bytes of prepared files per worker */
+        };
+
+        struct Stats
+        {
+            uint64_t workers;
+            uint64_t jobs;
+            uint64_t joins;
+            uint64_t prepare_us; /* in the workers, including their writes */
+            uint64_t write_us;   /* on the calling thread */
+        };
+
+      private:
+        struct Job
+        {
+            SquidFileHash* hash;
+            uint32_t generation;
+            uint32_t size;
+            uint32_t length;   /* of the prepared file */
+            void const* payload;
+            size_t offset;
+
+            bool dropped; /* the hash was returned since the submit */
+            bool direct;  /* written by the worker */
+            Error error;  /* of the worker's write */
+        };
+
+        struct Worker
+        {
+            Job* jobs;
+            size_t max_jobs;
+            size_t job_count;
+
+            uint8_t* buffer;
+            size_t buffer_size;
+            size_t buffer_used;
+        };
+
+        Backend& backend;
+        WorkerPool* pool;
+
+        Worker workers[MAX_WORKERS];
+        unsigned count = 0;
+
+        Stats stats{};
+
+        /**
+         * @brief Copies or seals the payloads of all jobs of a worker into
+         * its buffer, and writes the direct ones. Runs on the worker's
+         * thread.
+         */
+        void run(unsigned worker) override;
+
+        ParallelWriter(const ParallelWriter&) = delete;
+        ParallelWriter& operator=(const ParallelWriter&) = delete;
+
+      public:
+        ParallelWriter(Backend& backend, Config const&);
+        ~ParallelWriter(void);
+
+        unsigned workers_count(void) const { return count; }
+
+        /**
+         * @brief Queues payload for the worker owning the subtree of hash.
+         * Joins first if that worker's buffer is full.
+         */
+        enum Error submit(SquidFileHash* hash,
+                          void const* payload,
+                          size_t size);
+
+        /**
+         * @brief Prepares all queued payloads in parallel and writes them.
+         * @return First error encountered.
+         */
+        enum Error join(void);
+
+        Stats const& statistics(void) const { return stats; }
+    };
+
+    /**
+     * @brief Ships a completed snapshot to another node (e.g. a standby for
+     * failover) as one sequential stream instead of per-hash squid files:
+     *
+     *   <header> <manifest> <record> <record> ... <trailer>
+     *
+     * The manifest holds two bitmaps over all slots: the hashes that have
+     * data as of the snapshot, which are allocated on import, and the
+     * hashes carried by a record. Records follow in hash order and hold the
+     * squid file as stored, i.e. still encrypted if encryption is enabled.
+     *
+     * A full stream carries the newest version of every hash as of the
+     * snapshot. An incremental stream only carries the hashes whose newest
+     * version is in a snapshot newer than the base, and requires the base
+     * to be the newest snapshot on the receiving side.
+     *
+     * Header, manifest and each record carry a CRC-32C, the trailer one
+     * over the whole stream. Imports are written to /<squidroot>/import and
+     * only renamed to the snapshot id once the whole stream checked out.
+     */
+    class SnapshotStream
+    {
+      public:
+        static const uint32_t VERSION = 1;
+
+        /**
+         * @brief Largest squid file that fits into a record.
+         */
+        static const size_t MAX_RECORD_SIZE = 1024 * 1024;
+
+        enum Flags : uint32_t
+        {
+            INCREMENTAL = 1,
+            ENCRYPTED = 2
+        };
+
+        struct Header
+        {
+            char magic[8];
+            uint32_t version;
+            uint32_t flags;
+            uint64_t snapshot;
+            uint64_t base; /* 0 for a full stream */
+            uint64_t hash_count;
+            uint64_t records;
+            uint32_t checksum; /* of the fields above */
+            uint32_t reserved;
+        };
+
+        struct Record
+        {
+            uint64_t slot;
+            uint32_t size;
+            uint32_t checksum; /* of the squid file */
+        };
+
+        struct Trailer
+        {
+            char magic[8];
+            uint64_t records;
+            uint32_t checksum; /* of everything before the trailer */
+            uint32_t reserved;
+        };
+
+        static const size_t MANIFEST_SIZE = (HASH_COUNT + 7) / 8;
+
+        struct Manifest
+        {
+            uint8_t live[MANIFEST_SIZE];
+            uint8_t carried[MANIFEST_SIZE];
+        };
+
+      private:
+        static const size_t CHUNK_SIZE = 64 * 1024;
+
+        Stream& stream;
+
+        /**
+         * @brief Batches the stream I/O into CHUNK_SIZE transfers.
+         */
+        uint8_t* chunk;
+        size_t chunk_used = 0;
+        size_t chunk_size = 0;
+
+        uint8_t* file;
+
+        /**
+         * @brief Running CRC-32C of the stream up to the trailer.
+         */
+        uint32_t crc = 0;
+
+        Error put(void const* data, size_t size);
+        Error flush(void);
+
+        Error get(void* data, size_t size);
+
+        SnapshotStream(const SnapshotStream&) = delete;
+        SnapshotStream& operator=(const SnapshotStream&) = delete;
+
+      public:
+        SnapshotStream(Stream& stream);
+        ~SnapshotStream(void);
+
+        /**
+         * @brief Writes completed snapshot id to the stream, only with the
+         * hashes changed since snapshot base unless base is 0.
+         */
+        Error write(uint64_t id, uint64_t base);
+
+        /**
+         * @brief Rebuilds the snapshot held by the stream as a completed
+         * snapshot and allocates its hashes.
+         * @param id Set to the id of the imported snapshot.
+         * @return CorruptedFile if a checksum does not match.
+         */
+        Error read(uint64_t& id);
+
+        static uint32_t checksum(uint32_t crc, void const* data, size_t size);
+
+        static Path to_path(void);
+    };
 
     struct SquidUtils
     {
-        Env& _env;
-        SquidUtils(Env& env)
-          : _env(env){};
+        Backend& _backend;
+
+        Allocator& _heap;
+        Storage& _storage;
+        Clock& _timer;
+        ConfigSource& _config;
 
-        Heap _heap{ _env.ram(), _env.rm() };
-        Attached_rom_dataspace _config{ _env, "config" };
+        /**
+         * @brief Encrypts squid files if a master key is configured via
+         * <encryption key="..."/> or <encryption rom="..."/> (see crypto.h).
+         */
+        Constructible<Cipher> _master{};
+        uint32_t _master_id = 0;
+
+        /**
+         * @brief Key of the current snapshot, derived from _master.
+         */
+        Constructible<Cipher> _cipher{};
+        uint32_t _key_number = 0;
 
-        Vfs::Simple_env _vfs_env{ _env, _heap, _config.xml().sub_node("vfs") };
-        Root_directory _root_dir{ _env, _heap, _config.xml().sub_node("vfs") };
+        /**
+         * @brief Keys of completed snapshots, derived when first read.
+         */
+        struct Snapshot_key
+        {
+            uint32_t master_id;
+            uint32_t number;
+            Constructible<Cipher> cipher;
+        };
 
-        Genode::Entrypoint _ep_timer{ _env,
-                                      sizeof(Genode::addr_t) * 2048,
-                                      "entrypoint_timer",
-                                      Genode::Affinity::Location() };
+        static const unsigned KEY_CACHE = 8;
 
-        Timer::Connection _timer{ _env, _ep_timer, "squid_timer" };
+        Snapshot_key _keys[KEY_CACHE];
+        unsigned _keys_next = 0;
+
+        /**
+         * @brief Pooled buffer holding a squid file while it is sealed or
+         * opened, so the caller's payload is never modified.
+         */
+        uint8_t* _crypt_buffer = nullptr;
+
+        /**
+         * @brief Nonces sealed with the current key, restarted with every
+         * key.
+         */
+        uint64_t _nonce_counter = 0;
+
+        SquidUtils(Backend& backend)
+          : _backend(backend)
+          , _heap(backend.heap())
+          , _storage(backend.storage())
+          , _timer(backend.clock())
+          , _config(backend.config())
+        {
+            _init_encryption();
+        }
 
         // TODO proper error handling
-        void createdir(const Genode::Directory::Path& path);
+        void createdir(const Path& path);
+
+        /**
+         * @brief Value of attribute attr of the config node node, or
+         * default_value if it is not set.
+         */
+        template<typename T>
+        T config_value(char const* node, char const* attr, T default_value)
+        {
+            ConfigSource::Value value;
+            if (!_config.attribute(node, attr, value))
+                return default_value;
+
+            T result = default_value;
+            ascii_to(value.string(), result);
+
+            return result;
+        }
+
+        void _init_encryption(void);
+
+        /**
+         * @brief Reads master key id from the config, the active one from
+         * key/rom, retired ones from key<id>/<rom>.<id>.
+         * @return false if the key is not configured or invalid.
+         */
+        bool _load_key(uint32_t id, uint8_t key[Cipher::KEY_SIZE]);
+
+        /**
+         * @brief Cipher of the snapshot key named by a squid file's key id.
+         * @return nullptr if its master key is not configured.
+         */
+        Cipher* _snapshot_key(uint32_t master_id, uint32_t number);
+
+        bool encrypted(void) { return _cipher.constructed(); }
+        void set_key(uint8_t const key[Cipher::KEY_SIZE], uint32_t id = 0);
+        void clear_key(void);
+
+        /**
+         * @brief Takes the next snapshot key number from /<squidroot>/key.seq
+         * and stores it back, before the key is derived.
+         */
+        Error _claim_key_number(uint32_t& number);
+
+        /**
+         * @brief Derives a new key for the next snapshot, called when a
+         * snapshot finishes.
+         */
+        void rotate_key(void);
+
+        /**
+         * @brief Encrypts payload of the hash in the given slot into out,
+         * which must hold size + Cipher::OVERHEAD bytes. Thread-safe.
+         * @return Size of the encrypted squid file.
+         */
+        size_t seal(uint64_t slot,
+                    void const* payload,
+                    size_t size,
+                    uint8_t* out);
+
+        /**
+         * @brief Decrypts the squid file of the given size held in
+         * _crypt_buffer into payload.
+         * @return false if the file was tampered with or is corrupted.
+         */
+        bool open(uint64_t slot, size_t file_size, void* payload);
+
+        /**
+         * @brief Capacity of the staging ring, <staging size="..."/>.
+         */
+        size_t staging_size(void);
+
+        /**
+         * @brief I/O limits, <io bytes_per_sec="..." ops_per_sec="..."
+         * latency_us="..."/>.
+         */
+        IoScheduler::Config io_config(void);
+
+        struct Compaction_config
+        {
+            uint64_t keep;   /* 0 disables automatic compaction */
+            uint64_t budget; /* squid files per finished snapshot */
+        };
+
+        /**
+         * @brief Automatic compaction, <compaction keep="..." budget="..."/>.
+         */
+        Compaction_config compaction_config(void);
+
+        /**
+         * @brief Parallel mode, <parallel workers="..." cpu="..."
+         * buffer="..."/>.
+         */
+        ParallelWriter::Config parallel_config(void);
+
+        /**
+         * @brief Hot/cold thresholds, <classify hot="..." cold="..."/>.
+         */
+        Classifier::Config classify_config(void);
+
+        /**
+         * @brief Reads the squid file of slot as stored in a snapshot, i.e.
+         * still encrypted if encryption is enabled.
+         * @param packed Whether the snapshot holds it in its HotPack.
+         */
+        Error read_file(Path const& snapshot,
+                        uint64_t slot,
+                        bool packed,
+                        void* data,
+                        size_t capacity,
+                        size_t& size);
+
+        /**
+         * @brief Creates the directory tree of a snapshot.
+         */
+        void createtree(Path const& root);
+
+        /**
+         * @brief Removes the squid files and directories of a snapshot tree.
+         */
+        void removetree(Path const& root);
+
+        bool exists(Path const& path);
+
+        /**
+         * @brief Removes a file or an empty directory.
+         */
+        Error remove(Path const& path);
+
+        Error copy(Path const& from, Path const& to);
+
+        Error rename(Path const& from, Path const& to);
     };
 
     class Main
@@ -249,11 +1430,48 @@ namespace SquidSnapshot {
         Main(SquidSnapshot::SquidUtils*);
         void finish();
 
+        /**
+         * @brief Writes all payloads still pending in the staging ring or
+         * the parallel writer.
+         */
+        enum Error flush(void);
+
         /**
          * @brief Responsible for managing file structure of snapshot.
          */
         SnapshotRoot root_manager{};
 
+        /**
+         * @brief Payloads captured by squid_stage() until they are drained.
+         */
+        StagingRing staging;
+
+        /**
+         * @brief Throttles squid file writes, see IoScheduler.
+         */
+        IoScheduler io_scheduler;
+
+        SnapshotHistory history{};
+
+        Compactor compactor{};
+
+        Reclaimer reclaimer{};
+
+        Classifier classifier;
+
+        HotPack hot_pack{};
+
+        /**
+         * @brief Number of snapshots finished since start-up, plus one, so
+         * that a file epoch of 0 marks a hash without a file in current.
+         */
+        uint32_t epoch = 1;
+
+        /**
+         * @brief Only constructed if workers are configured.
+         */
+        Constructible<ParallelWriter> parallel{};
+
         /**
          * @brief Unit test.
          */
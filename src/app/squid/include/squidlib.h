@@ -28,7 +28,81 @@ extern "C"
         SQUID_CORRUPTED,
         SQUID_DELETE,
         SQUID_FULL,
-        SQUID_NONE
+        SQUID_NONE,
+
+        /* appended, so that the values above stay stable for C callers */
+        SQUID_BUSY,
+
+        /* the hash was deleted, or is not allocated */
+        SQUID_INVALID
+    };
+
+    /*
+     * Write frequency of a hash over the last completed snapshots, see
+     * <classify hot="..." cold="..."/>.
+     */
+    enum SquidClass
+    {
+        SQUID_COLD,
+        SQUID_WARM,
+        SQUID_HOT
+    };
+
+    struct SquidStats
+    {
+        /* staging ring occupancy, in bytes */
+        unsigned long long staging_capacity;
+        unsigned long long staging_used;
+        unsigned long long staging_high_water;
+        unsigned long long staging_entries;
+
+        /* payloads written synchronously because the ring was full */
+        unsigned long long staging_overflows;
+
+        /* payloads not written, because their hash was deleted or failed */
+        unsigned long long staging_dropped;
+
+        unsigned long long staged_bytes;
+        unsigned long long drained_bytes;
+
+        /* bytes per second spent draining */
+        unsigned long long drain_rate;
+
+        /* squid file writes issued through the I/O scheduler */
+        unsigned long long io_ops;
+        unsigned long long io_bytes;
+
+        /* time spent waiting for the rate limits and the backoff */
+        unsigned long long io_throttled_us;
+
+        /* moving average of the write latency, and the backoff level */
+        unsigned long long io_latency_us;
+        unsigned long long io_backoff;
+
+        /* squid files left to process by the running compaction */
+        unsigned long long compaction_remaining;
+
+        /* deleted hashes whose squid files are not reclaimed yet */
+        unsigned long long reclaim_pending;
+        unsigned long long reclaim_dead_bytes;
+
+        unsigned long long reclaimed;
+        unsigned long long reclaimed_bytes;
+        unsigned long long reclaim_batches;
+
+        /* hashes per class, and the HotPack of the current snapshot */
+        unsigned long long classify_hot;
+        unsigned long long classify_cold;
+        unsigned long long hot_pack_records;
+        unsigned long long hot_pack_writes;
+        unsigned long long hot_pack_bytes;
+
+        /* parallel writer, all 0 if it is not configured */
+        unsigned long long parallel_workers;
+        unsigned long long parallel_jobs;
+        unsigned long long parallel_joins;
+        unsigned long long parallel_prepare_us;
+        unsigned long long parallel_write_us;
     };
 
 #define SQUID_ERROR_RED "\033[31m"
@@ -37,11 +111,131 @@ extern "C"
 #define SQUID_ERROR_FMT "[" SQUID_ERROR_RED "SQUID ERROR" SQUID_ERROR_RESET "] "
 
     enum SquidError squid_hash(void** hash);
+
+    /*
+     * Like squid_hash(), but places the hash near `key`. Consecutive keys
+     * land in ascending file ids of the same L2 directory, so passing e.g.
+     * the page frame number (address / page size) keeps snapshot and
+     * restore I/O in directory order.
+     */
+    enum SquidError squid_hash_near(void** hash, unsigned long long key);
     enum SquidError squid_write(void* hash,
                                 void* payload,
                                 unsigned long long size);
     enum SquidError squid_read(void* hash, void* payload);
+
+    /*
+     * Reads the payload `hash` had when the completed snapshot `snapshot`
+     * (its timestamp) was taken. Fails with SQUID_READ if the snapshot is
+     * not retained or did not have the hash yet.
+     */
+    enum SquidError squid_read_at(void* hash,
+                                  unsigned long long snapshot,
+                                  void* payload);
+
+    /*
+     * Stores the ids of the completed snapshots holding a squid file for
+     * `hash` in `snapshots` (oldest first, at most `max`). `count` receives
+     * the total number of such snapshots.
+     */
+    enum SquidError squid_snapshots_with(void* hash,
+                                         unsigned long long* snapshots,
+                                         unsigned long long max,
+                                         unsigned long long* count);
+
+    /*
+     * Copies payload into the staging ring and returns without touching
+     * the disk, so pages only stay locked for the duration of a memcpy.
+     * Staged payloads are written by squid_drain() (`budget` bytes of
+     * payload, 0 for all) and at the latest when the snapshot finishes.
+     */
+    enum SquidError squid_stage(void* hash,
+                                void* payload,
+                                unsigned long long size);
+    enum SquidError squid_drain(unsigned long long budget);
+
+    /*
+     * Queues payload for the worker thread owning the subtree of the hash
+     * (see <parallel workers="..."/>). The workers copy and encrypt the
+     * queued payloads in parallel at squid_join(), which also writes them.
+     * Payloads must stay valid until then. Writes synchronously if no
+     * workers are configured.
+     */
+    enum SquidError squid_submit(void* hash,
+                                 void* payload,
+                                 unsigned long long size);
+    enum SquidError squid_join(void);
+
+    /*
+     * Invalidates `hash` right away. Its squid file is removed later, by
+     * squid_reclaim() (`budget` hashes, 0 for all, one L2 directory at a
+     * time), at the latest when the snapshot finishes, after which the
+     * hash can be handed out again. Until then its file counts as dead
+     * data in the stats.
+     */
     enum SquidError squid_delete(void* hash);
+    enum SquidError squid_reclaim(unsigned long long budget);
+
+    enum SquidError squid_stats(struct SquidStats* stats);
+
+    /*
+     * Urgent mode lets writes bypass the I/O limits, e.g. for the snapshot
+     * taken at shutdown.
+     */
+    enum SquidError squid_urgent(int enable);
+
+    /*
+     * Hot hashes were written in at least `hot` of the last 8 completed
+     * snapshots and are overwritten in place in the snapshot's packed
+     * region. Cold hashes were not written in the last `cold` ones, their
+     * pages need not be checked for changes. A hash is warm otherwise, or
+     * as soon as it is written. 0 disables the respective class.
+     */
+    enum SquidError squid_classify(void* hash, enum SquidClass* cls);
+    enum SquidError squid_set_classify(unsigned hot, unsigned cold);
+
+    /*
+     * Merges the completed snapshots with ids (timestamps) in [from, to]
+     * into one, keeping the newest version of each hash. The work is done
+     * incrementally by squid_compact_step(), at most `budget` squid files
+     * at a time, until `compaction_remaining` in the stats drops to 0.
+     * Returns SQUID_BUSY if a compaction is already running.
+     */
+    enum SquidError squid_compact(unsigned long long from,
+                                  unsigned long long to);
+    enum SquidError squid_compact_step(unsigned long long budget);
+
+    /*
+     * Returns the hash in slot `slot` (see squid_slot()), allocating it if
+     * it is free, e.g. to reach hashes imported via squid_import(). Returns
+     * SQUID_BUSY if the hash is already handed out. squid_slot() returns
+     * SQUID_INVALID for a deleted hash.
+     */
+    enum SquidError squid_hash_at(void** hash, unsigned long long slot);
+    enum SquidError squid_slot(void* hash, unsigned long long* slot);
+
+    /*
+     * Writes the completed snapshot `snapshot` as one sequential,
+     * checksummed stream to `target` (a file, or a File_system or Terminal
+     * session mounted into the VFS), e.g. to replicate it to a standby.
+     * With a non-zero `base`, only the hashes changed since that snapshot
+     * are carried. Returns SQUID_CORRUPTED if a file of the snapshot cannot
+     * be read back intact.
+     */
+    enum SquidError squid_export(char const* target,
+                                 unsigned long long snapshot,
+                                 unsigned long long base);
+
+    /*
+     * Rebuilds the snapshot held by the stream at `source` as a completed
+     * snapshot, allocates its hashes and stores its id in `snapshot`. An
+     * incremental stream requires its base to be the newest snapshot.
+     * Returns SQUID_CORRUPTED if a checksum does not match, and SQUID_BUSY
+     * while a compaction is running or if a hash of the stream is handed
+     * out here.
+     */
+    enum SquidError squid_import(char const* source,
+                                 unsigned long long* snapshot);
 
     enum SquidError squid_test(void);
 
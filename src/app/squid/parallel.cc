@@ -0,0 +1,209 @@
+#include "squid.h"
+
+#include <util/string.h>
+
+namespace SquidSnapshot {
+
+    ParallelWriter::ParallelWriter(Backend& backend, Config const& config)
+      : backend(backend)
+    {
+        count = config.workers;
+        if (count > MAX_WORKERS)
+            count = MAX_WORKERS;
+
+        for (unsigned i = 0; i < count; i++) {
+            Worker& worker = workers[i];
+
+            worker.max_jobs = config.buffer / 512 + 1;
+            worker.job_count = 0;
+            worker.jobs =
+              (Job*)backend.heap().alloc(sizeof(Job) * worker.max_jobs);
+
+            worker.buffer_size = config.buffer;
+            worker.buffer_used = 0;
+            worker.buffer = (uint8_t*)backend.heap().alloc(config.buffer);
+        }
+
+        pool = backend.create_pool(count, config.cpu);
+
+        stats.workers = count;
+    }
+
+    ParallelWriter::~ParallelWriter(void)
+    {
+        join();
+
+        backend.destroy_pool(pool);
+
+        for (unsigned i = 0; i < count; i++) {
+            Worker& worker = workers[i];
+
+            backend.heap().free(worker.jobs, sizeof(Job) * worker.max_jobs);
+            backend.heap().free(worker.buffer, worker.buffer_size);
+        }
+    }
+
+    void ParallelWriter::run(unsigned index)
+    {
+        SquidUtils* utils = SquidSnapshot::squidutils;
+        IoScheduler& io = SquidSnapshot::global_squid->io_scheduler;
+        Worker& worker = workers[index];
+
+        for (size_t i = 0; i < worker.job_count; i++) {
+            Job& job = worker.jobs[i];
+            uint8_t* out = worker.buffer + job.offset;
+
+            if (job.dropped)
+                continue;
+
+            if (utils->encrypted())
+                job.length = (uint32_t)utils->seal(
+                  job.hash->slot(), job.payload, job.size, out);
+            else {
+                Genode::memcpy(out, job.payload, job.size);
+                job.length = job.size;
+            }
+
+            if (!job.direct)
+                continue;
+
+            // INFO: The slots of a worker's subtrees are its own, so no two
+            // workers write the same file. The I/O scheduler is shared, each
+            // write is admitted and accounted on its own.
+            pool->lock();
+            uint64_t start = io.admit(job.length);
+            pool->unlock();
+
+            job.error =
+              utils->_storage.write(job.hash->to_path(), out, job.length);
+
+            pool->lock();
+            io.complete(start);
+            pool->unlock();
+        }
+    }
+
+    Error ParallelWriter::submit(SquidFileHash* hash,
+                                 void const* payload,
+                                 size_t size)
+    {
+        if (!hash->is_valid)
+            return Error::InvalidHash;
+
+        if (count == 0)
+            return hash->write((void*)payload, size);
+
+        Worker& worker = workers[hash->l1_dir % count];
+
+        // INFO: Room for the encryption overhead is always reserved, since
+        // a key may be set before the join point. Files are kept aligned
+        // for the copy loops of the workers.
+        size_t need = (size + Cipher::OVERHEAD + 15) & ~(size_t)15;
+
+        if (size > MAX_PAYLOAD_SIZE || need > worker.buffer_size)
+            return hash->write((void*)payload, size);
+
+        if (worker.job_count == worker.max_jobs ||
+            worker.buffer_size - worker.buffer_used < need) {
+            Error err = join();
+
+            if (err != Error::None)
+                return err;
+        }
+
+        Job& job = worker.jobs[worker.job_count++];
+
+        job.hash = hash;
+        job.generation = hash->generation;
+        job.size = (uint32_t)size;
+        job.length = 0;
+        job.payload = payload;
+        job.dropped = false;
+        job.direct = false;
+        job.error = Error::None;
+        job.offset = worker.buffer_used;
+
+        worker.buffer_used += need;
+
+        hash->staged++;
+
+        stats.jobs++;
+
+        return Error::None;
+    }
+
+    Error ParallelWriter::join(void)
+    {
+        unsigned busy = 0;
+
+        for (unsigned i = 0; i < count; i++)
+            if (workers[i].job_count != 0)
+                busy++;
+
+        if (busy == 0)
+            return Error::None;
+
+        Main& squid = *SquidSnapshot::global_squid;
+        bool const concurrent = backend.storage().concurrent();
+
+        // INFO: Decided before the workers run, while the calling thread
+        // owns the hashes and the HotPack.
+        for (unsigned i = 0; i < count; i++) {
+            Worker& worker = workers[i];
+
+            for (size_t j = 0; j < worker.job_count; j++) {
+                Job& job = worker.jobs[j];
+                uint64_t const slot = job.hash->slot();
+
+                job.dropped = !job.hash->is_valid ||
+                              job.hash->generation != job.generation;
+
+                job.direct = concurrent && !job.dropped &&
+                             !squid.classifier.is_hot(slot) &&
+                             !squid.hot_pack.contains(slot);
+            }
+        }
+
+        Clock& timer = backend.clock();
+        uint64_t start = timer.elapsed_us();
+
+        pool->run(*this);
+
+        uint64_t prepared = timer.elapsed_us();
+
+        Error result = Error::None;
+
+        for (unsigned i = 0; i < count; i++) {
+            Worker& worker = workers[i];
+
+            for (size_t j = 0; j < worker.job_count; j++) {
+                Job& job = worker.jobs[j];
+
+                job.hash->staged--;
+
+                if (job.dropped)
+                    continue;
+
+                Error err = job.error;
+
+                if (!job.direct)
+                    err = job.hash->write_raw(worker.buffer + job.offset,
+                                              job.length);
+                else if (err == Error::None)
+                    job.hash->wrote(job.length);
+
+                if (err != Error::None && result == Error::None)
+                    result = err;
+            }
+
+            worker.job_count = 0;
+            worker.buffer_used = 0;
+        }
+
+        stats.joins++;
+        stats.prepare_us += prepared - start;
+        stats.write_us += timer.elapsed_us() - prepared;
+
+        return result;
+    }
+}; // namespace SquidSnapshot
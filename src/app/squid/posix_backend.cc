@@ -0,0 +1,603 @@
+#include "posix_backend.h"
+
+#include <base/exception.h>
+#include <base/log.h>
+#include <util/string.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace SquidSnapshot {
+
+    void* PosixBackend::MallocAllocator::alloc(size_t size)
+    {
+        void* addr = ::malloc(size);
+        if (addr == nullptr)
+            throw Out_of_memory();
+
+        return addr;
+    }
+
+    void PosixBackend::MallocAllocator::free(void* addr, size_t)
+    {
+        ::free(addr);
+    }
+
+    PosixBackend::Host_path PosixBackend::FileStorage::_host(
+      Path const& path) const
+    {
+        return Host_path(_root, path);
+    }
+
+    Error PosixBackend::FileStorage::create_dir(Path const& path)
+    {
+        if (::mkdir(_host(path).string(), 0755) != 0 && errno != EEXIST) {
+            if (errno == EACCES)
+                Genode::error("reason: permission");
+
+            return Error::CreateFile;
+        }
+
+        return Error::None;
+    }
+
+    bool PosixBackend::FileStorage::directory_exists(Path const& path)
+    {
+        struct stat st;
+        return ::stat(_host(path).string(), &st) == 0 && S_ISDIR(st.st_mode);
+    }
+
+    bool PosixBackend::FileStorage::file_exists(Path const& path)
+    {
+        struct stat st;
+        return ::stat(_host(path).string(), &st) == 0 && S_ISREG(st.st_mode);
+    }
+
+    Error PosixBackend::FileStorage::write(Path const& path,
+                                           void const* data,
+                                           size_t size)
+    {
+        int fd =
+          ::open(_host(path).string(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            return Error::CreateFile;
+
+        Error result = Error::None;
+
+        for (size_t done = 0; done < size;) {
+            ssize_t n = ::write(fd, (char const*)data + done, size - done);
+
+            if (n < 0 && errno == EINTR)
+                continue;
+
+            if (n <= 0) {
+                result = Error::WriteFile;
+                break;
+            }
+
+            done += (size_t)n;
+        }
+
+        ::close(fd);
+
+        return result;
+    }
+
+    Error PosixBackend::FileStorage::read(Path const& path,
+                                          void* data,
+                                          size_t capacity,
+                                          size_t& size)
+    {
+        int fd = ::open(_host(path).string(), O_RDONLY);
+        if (fd < 0)
+            return Error::ReadFile;
+
+        Error result = Error::None;
+
+        size = 0;
+        while (size < capacity) {
+            size_t chunk = capacity - size;
+            if (chunk > 1024 * 1024)
+                chunk = 1024 * 1024;
+
+            ssize_t n = ::read(fd, (char*)data + size, chunk);
+
+            if (n < 0 && errno == EINTR)
+                continue;
+
+            if (n < 0) {
+                result = Error::ReadFile;
+                break;
+            }
+
+            if (n == 0)
+                break;
+
+            size += (size_t)n;
+        }
+
+        ::close(fd);
+
+        return result;
+    }
+
+    Error PosixBackend::FileStorage::write_at(Path const& path,
+                                              uint64_t offset,
+                                              void const* data,
+                                              size_t size)
+    {
+        int fd = ::open(_host(path).string(), O_WRONLY | O_CREAT, 0644);
+        if (fd < 0)
+            return Error::CreateFile;
+
+        Error result = Error::None;
+
+        for (size_t done = 0; done < size;) {
+            ssize_t n = ::pwrite(fd,
+                                 (char const*)data + done,
+                                 size - done,
+                                 (off_t)(offset + done));
+
+            if (n < 0 && errno == EINTR)
+                continue;
+
+            if (n <= 0) {
+                result = Error::WriteFile;
+                break;
+            }
+
+            done += (size_t)n;
+        }
+
+        ::close(fd);
+
+        return result;
+    }
+
+    Error PosixBackend::FileStorage::read_at(Path const& path,
+                                             uint64_t offset,
+                                             void* data,
+                                             size_t size,
+                                             size_t& read)
+    {
+        int fd = ::open(_host(path).string(), O_RDONLY);
+        if (fd < 0)
+            return Error::ReadFile;
+
+        Error result = Error::None;
+
+        read = 0;
+        while (read < size) {
+            ssize_t n = ::pread(
+              fd, (char*)data + read, size - read, (off_t)(offset + read));
+
+            if (n < 0 && errno == EINTR)
+                continue;
+
+            if (n < 0) {
+                result = Error::ReadFile;
+                break;
+            }
+
+            if (n == 0)
+                break;
+
+            read += (size_t)n;
+        }
+
+        ::close(fd);
+
+        return result;
+    }
+
+    Error PosixBackend::FileStorage::copy(Path const& from, Path const& to)
+    {
+        int src = ::open(_host(from).string(), O_RDONLY);
+        if (src < 0)
+            return Error::ReadFile;
+
+        int dst =
+          ::open(_host(to).string(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (dst < 0) {
+            ::close(src);
+            return Error::CreateFile;
+        }
+
+        Error result = Error::None;
+        char chunk[4096];
+
+        for (;;) {
+            ssize_t n = ::read(src, chunk, sizeof(chunk));
+
+            if (n < 0 && errno == EINTR)
+                continue;
+
+            if (n < 0) {
+                result = Error::ReadFile;
+                break;
+            }
+
+            if (n == 0)
+                break;
+
+            if (::write(dst, chunk, (size_t)n) != n) {
+                result = Error::WriteFile;
+                break;
+            }
+        }
+
+        ::close(src);
+        ::close(dst);
+
+        return result;
+    }
+
+    Error PosixBackend::FileStorage::unlink(Path const& path)
+    {
+        Host_path const host = _host(path);
+
+        if (::unlink(host.string()) == 0 || errno == ENOENT)
+            return Error::None;
+
+        // INFO: The Genode VFS removes empty directories via unlink too.
+        if ((errno == EISDIR || errno == EPERM) && ::rmdir(host.string()) == 0)
+            return Error::None;
+
+        return Error::DeleteFile;
+    }
+
+    Error PosixBackend::FileStorage::rename(Path const& from, Path const& to)
+    {
+        if (::rename(_host(from).string(), _host(to).string()) != 0)
+            return Error::WriteFile;
+
+        return Error::None;
+    }
+
+    bool PosixBackend::FileStorage::list(Path const& path,
+                                         Entry_handler& handler)
+    {
+        Host_path const host = _host(path);
+
+        DIR* dir = ::opendir(host.string());
+        if (dir == nullptr)
+            return false;
+
+        for (struct dirent* entry = ::readdir(dir); entry != nullptr;
+             entry = ::readdir(dir)) {
+
+            if (Genode::strcmp(entry->d_name, ".") == 0 ||
+                Genode::strcmp(entry->d_name, "..") == 0)
+                continue;
+
+            bool is_dir = entry->d_type == DT_DIR;
+
+            if (entry->d_type == DT_UNKNOWN) {
+                struct stat st;
+                Host_path const child(host, "/", (char const*)entry->d_name);
+
+                is_dir = ::stat(child.string(), &st) == 0 &&
+                         S_ISDIR(st.st_mode);
+            }
+
+            handler.handle(entry->d_name, is_dir);
+        }
+
+        ::closedir(dir);
+
+        return true;
+    }
+
+    PosixBackend::FileStream::~FileStream(void)
+    {
+        ::close(_fd);
+    }
+
+    Error PosixBackend::FileStream::write(void const* data, size_t size)
+    {
+        for (size_t done = 0; done < size;) {
+            ssize_t n = ::write(_fd, (char const*)data + done, size - done);
+
+            if (n < 0 && errno == EINTR)
+                continue;
+
+            if (n <= 0)
+                return Error::WriteFile;
+
+            done += (size_t)n;
+        }
+
+        return Error::None;
+    }
+
+    Error PosixBackend::FileStream::read(void* data, size_t size, size_t& read)
+    {
+        read = 0;
+        while (read < size) {
+            ssize_t n = ::read(_fd, (char*)data + read, size - read);
+
+            if (n < 0 && errno == EINTR)
+                continue;
+
+            if (n < 0)
+                return Error::ReadFile;
+
+            if (n == 0)
+                break;
+
+            read += (size_t)n;
+        }
+
+        return Error::None;
+    }
+
+    static uint64_t clock_us(clockid_t id)
+    {
+        struct timespec ts;
+        ::clock_gettime(id, &ts);
+
+        return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+    }
+
+    PosixBackend::MonotonicClock::MonotonicClock(void)
+      : _start_us(clock_us(CLOCK_MONOTONIC))
+    {
+    }
+
+    uint64_t PosixBackend::MonotonicClock::elapsed_us(void)
+    {
+        return clock_us(CLOCK_MONOTONIC) - _start_us;
+    }
+
+    uint64_t PosixBackend::MonotonicClock::curr_time_us(void)
+    {
+        return clock_us(CLOCK_REALTIME);
+    }
+
+    void PosixBackend::MonotonicClock::usleep(uint64_t us)
+    {
+        struct timespec ts;
+        ts.tv_sec = (time_t)(us / 1000000);
+        ts.tv_nsec = (long)(us % 1000000) * 1000;
+
+        while (::nanosleep(&ts, &ts) != 0 && errno == EINTR)
+            ;
+    }
+
+    PosixBackend::FileConfig::FileConfig(char const* path)
+      : _xml((char*)::calloc(1, MAX_SIZE + 1))
+    {
+        if (path == nullptr)
+            return;
+
+        FILE* file = ::fopen(path, "r");
+        if (file == nullptr) {
+            Genode::error("squid: couldn't open config ", path);
+            return;
+        }
+
+        size_t size = ::fread(_xml, 1, MAX_SIZE, file);
+        _xml[size] = 0;
+
+        ::fclose(file);
+    }
+
+    PosixBackend::FileConfig::~FileConfig(void)
+    {
+        ::free(_xml);
+    }
+
+    char const* PosixBackend::FileConfig::_node(char const* node) const
+    {
+        size_t const len = Genode::strlen(node);
+
+        for (char const* p = _xml; *p != 0; p++) {
+            if (p[0] != '<' || Genode::strcmp(p + 1, node, len) != 0)
+                continue;
+
+            char const end = p[1 + len];
+            if (end == ' ' || end == '\t' || end == '\n' || end == '/' ||
+                end == '>')
+                return p + 1 + len;
+        }
+
+        return nullptr;
+    }
+
+    bool PosixBackend::FileConfig::has_node(char const* node)
+    {
+        return _node(node) != nullptr;
+    }
+
+    bool PosixBackend::FileConfig::attribute(char const* node,
+                                             char const* attr,
+                                             Value& value)
+    {
+        char const* p = _node(node);
+        if (p == nullptr)
+            return false;
+
+        size_t const len = Genode::strlen(attr);
+
+        for (; *p != 0 && *p != '>'; p++) {
+            if (p[-1] != ' ' && p[-1] != '\t' && p[-1] != '\n')
+                continue;
+
+            if (Genode::strcmp(p, attr, len) != 0 || p[len] != '=' ||
+                p[len + 1] != '"')
+                continue;
+
+            char const* start = p + len + 2;
+            char const* end = start;
+            for (; *end != 0 && *end != '"'; end++)
+                ;
+
+            value = Value(Cstring(start, (size_t)(end - start)));
+            return true;
+        }
+
+        return false;
+    }
+
+    size_t PosixBackend::FileConfig::module(char const* name,
+                                            char* data,
+                                            size_t size)
+    {
+        FILE* file = ::fopen(name, "r");
+        if (file == nullptr)
+            return 0;
+
+        size = ::fread(data, 1, size, file);
+
+        ::fclose(file);
+
+        return size;
+    }
+
+    void* PosixBackend::PthreadPool::_entry(void* arg)
+    {
+        Start* start = (Start*)arg;
+        start->pool->_work(start->index);
+
+        return nullptr;
+    }
+
+    void PosixBackend::PthreadPool::_work(unsigned index)
+    {
+        uint64_t seen = 0;
+
+        for (;;) {
+            ::pthread_mutex_lock(&_mutex);
+
+            while (_round == seen && !_exit)
+                ::pthread_cond_wait(&_start, &_mutex);
+
+            if (_exit) {
+                ::pthread_mutex_unlock(&_mutex);
+                return;
+            }
+
+            seen = _round;
+            Task* task = _task;
+
+            ::pthread_mutex_unlock(&_mutex);
+
+            task->run(index);
+
+            ::pthread_mutex_lock(&_mutex);
+
+            if (++_finished == _count)
+                ::pthread_cond_signal(&_done);
+
+            ::pthread_mutex_unlock(&_mutex);
+        }
+    }
+
+    PosixBackend::PthreadPool::PthreadPool(unsigned workers,
+                                           unsigned cpu,
+                                           unsigned cpus)
+      : _count(workers < MAX_WORKERS ? workers : MAX_WORKERS)
+    {
+        for (unsigned i = 0; i < _count; i++) {
+            _starts[i] = Start{ this, i };
+
+            pthread_attr_t attr;
+            ::pthread_attr_init(&attr);
+
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET((cpu + i) % cpus, &set);
+            ::pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+
+            int err =
+              ::pthread_create(&_threads[i], &attr, _entry, &_starts[i]);
+
+            ::pthread_attr_destroy(&attr);
+
+            if (err != 0) {
+                Genode::error("squid: couldn't start worker ", i);
+
+                // INFO: The destructor does not run for a pool that failed
+                // to construct, the workers started so far are stopped here.
+                _count = i;
+                _stop();
+
+                throw Exception();
+            }
+        }
+    }
+
+    PosixBackend::PthreadPool::~PthreadPool(void)
+    {
+        _stop();
+    }
+
+    void PosixBackend::PthreadPool::_stop(void)
+    {
+        ::pthread_mutex_lock(&_mutex);
+        _exit = true;
+        ::pthread_cond_broadcast(&_start);
+        ::pthread_mutex_unlock(&_mutex);
+
+        for (unsigned i = 0; i < _count; i++)
+            ::pthread_join(_threads[i], nullptr);
+    }
+
+    void PosixBackend::PthreadPool::run(Task& task)
+    {
+        ::pthread_mutex_lock(&_mutex);
+
+        _task = &task;
+        _finished = 0;
+        _round++;
+
+        ::pthread_cond_broadcast(&_start);
+
+        while (_finished != _count)
+            ::pthread_cond_wait(&_done, &_mutex);
+
+        ::pthread_mutex_unlock(&_mutex);
+    }
+
+    unsigned PosixBackend::cpu_count(void)
+    {
+        long cpus = ::sysconf(_SC_NPROCESSORS_ONLN);
+
+        return cpus > 0 ? (unsigned)cpus : 1;
+    }
+
+    Stream* PosixBackend::open_stream(Path const& path, bool write)
+    {
+        Host_path const host = _storage._host(path);
+
+        int fd = write
+                   ? ::open(host.string(), O_WRONLY | O_CREAT | O_TRUNC, 0644)
+                   : ::open(host.string(), O_RDONLY);
+        if (fd < 0)
+            return nullptr;
+
+        return new (_heap) FileStream(fd);
+    }
+
+    void PosixBackend::close_stream(Stream* stream)
+    {
+        destroy(_heap, static_cast<FileStream*>(stream));
+    }
+
+    WorkerPool* PosixBackend::create_pool(unsigned workers, unsigned cpu)
+    {
+        return new (_heap) PthreadPool(workers, cpu, cpu_count());
+    }
+
+    void PosixBackend::destroy_pool(WorkerPool* pool)
+    {
+        destroy(_heap, static_cast<PthreadPool*>(pool));
+    }
+}; // namespace SquidSnapshot
@@ -0,0 +1,156 @@
+#include "squid.h"
+#include "squidlib.h"
+
+namespace SquidSnapshot {
+
+    Error Reclaimer::defer(SquidFileHash* hash)
+    {
+        if (!hash->is_valid)
+            return Error::InvalidHash;
+
+        Main& squid = *SquidSnapshot::global_squid;
+
+        uint64_t slot = hash->slot();
+
+        // INFO: Payloads of the hash still staged are dropped, just like
+        // for hashes returned right away.
+        hash->is_valid = false;
+        hash->generation++;
+
+        if (hash->file_epoch == squid.epoch || squid.hot_pack.contains(slot))
+            stored.set(slot, 1);
+        else
+            hash->file_size = 0;
+
+        squid.classifier.forget(slot);
+
+        pending.set(slot, 1);
+        hashes[slot] = hash;
+
+        stats.pending++;
+        stats.dead_bytes += hash->file_size;
+
+        return Error::None;
+    }
+
+    uint64_t Reclaimer::reclaim_dir(uint64_t dir, uint64_t& budget)
+    {
+        IoScheduler& io = SquidSnapshot::global_squid->io_scheduler;
+        HotPack& hot_pack = SquidSnapshot::global_squid->hot_pack;
+        SnapshotHistory& history = SquidSnapshot::global_squid->history;
+        Path current = SquidSnapshot::global_squid->root_manager.to_path();
+
+        uint64_t first = HASH_COUNT;
+
+        for (uint64_t slot = dir * L2_SIZE;
+             slot < (dir + 1) * L2_SIZE && budget > 0;
+             slot++) {
+
+            if (!pending.get(slot, 1))
+                continue;
+
+            SquidFileHash* hash = hashes[slot];
+
+            uint64_t id = 0;
+            bool const older = history.newest_with(slot, id);
+            bool const packed = hot_pack.contains(slot);
+
+            uint64_t start = io.admit(0);
+
+            Error err = Error::None;
+            if (packed)
+                err = hot_pack.remove(slot);
+
+            // INFO: Slots the completed snapshots hold get a tombstone,
+            // which overwrites a file in current as well. Otherwise only
+            // a file actually written to current has to go.
+            if (err == Error::None && older)
+                err = tombstone(hash_path(current, slot), slot);
+            else if (err == Error::None && stored.get(slot, 1) && !packed)
+                err = SquidSnapshot::squidutils->remove(
+                  hash_path(current, slot));
+
+            io.complete(start);
+
+            // INFO: A file left behind or a missing tombstone only matters
+            // until the next write of the slot, it can be handed out either
+            // way.
+            if (err != Error::None)
+                Genode::warning("squid: couldn't reclaim slot ", slot);
+
+            pending.clear(slot, 1);
+            if (stored.get(slot, 1))
+                stored.clear(slot, 1);
+
+            stats.pending--;
+            stats.dead_bytes -= hash->file_size;
+            stats.reclaimed++;
+            stats.reclaimed_bytes += hash->file_size;
+
+            // INFO: A tombstone is a file in current, the next owner has to
+            // drop it when packing the slot.
+            hash->file_size = 0;
+            hash->file_epoch =
+              older ? SquidSnapshot::global_squid->epoch : 0;
+            hash->parent->return_entry(hash->file_id);
+
+            if (first == HASH_COUNT)
+                first = slot;
+
+            budget--;
+        }
+
+        stats.batches++;
+
+        return first;
+    }
+
+    Error Reclaimer::tombstone(Path const& path, uint64_t slot)
+    {
+        SquidUtils& utils = *SquidSnapshot::squidutils;
+
+        if (!utils.encrypted())
+            return utils._storage.write(path, nullptr, 0);
+
+        // INFO: Encrypted, an empty payload is still sealed, so that reads
+        // can tell the tombstone from a truncated file.
+        char const empty = 0;
+        size_t size = utils.seal(slot, &empty, 0, utils._crypt_buffer);
+
+        return utils._storage.write(path, utils._crypt_buffer, size);
+    }
+
+    void Reclaimer::step(uint64_t budget)
+    {
+        if (budget == 0)
+            budget = HASH_COUNT;
+
+        for (uint64_t dirs = 0;
+             dirs < DIR_COUNT && budget > 0 && !is_empty();
+             dirs++) {
+
+            if (pending.get(cursor * L2_SIZE, L2_SIZE))
+                reclaim_dir(cursor, budget);
+
+            // INFO: Stay at a directory until all of its slots are done.
+            if (!pending.get(cursor * L2_SIZE, L2_SIZE))
+                cursor = (cursor + 1) % DIR_COUNT;
+        }
+    }
+
+    SquidFileHash* Reclaimer::take(void)
+    {
+        for (uint64_t dirs = 0; dirs < DIR_COUNT && !is_empty(); dirs++) {
+            if (pending.get(cursor * L2_SIZE, L2_SIZE)) {
+                uint64_t budget = L2_SIZE;
+                uint64_t slot = reclaim_dir(cursor, budget);
+
+                return SquidSnapshot::global_squid->root_manager.hash_at(slot);
+            }
+
+            cursor = (cursor + 1) % DIR_COUNT;
+        }
+
+        return nullptr;
+    }
+}; // namespace SquidSnapshot
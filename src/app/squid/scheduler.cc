@@ -0,0 +1,149 @@
+#include "squid.h"
+
+namespace SquidSnapshot {
+
+    namespace {
+        /**
+         * @brief Bucket capacity, in fractions of a second of the rate.
+         */
+        const uint64_t BURST_DIVISOR = 10;
+
+        inline int64_t burst(uint64_t rate)
+        {
+            uint64_t b = rate / BURST_DIVISOR;
+            return b ? (int64_t)b : 1;
+        }
+
+        /**
+         * @brief Microseconds until tokens reach need at the given rate.
+         */
+        inline uint64_t wait_for(int64_t tokens, int64_t need, uint64_t rate)
+        {
+            if (tokens >= need)
+                return 0;
+
+            return (uint64_t)(need - tokens) * 1000000 / rate + 1;
+        }
+
+        /**
+         * @brief Adds the tokens accrued over elapsed microseconds. The
+         * remainder holds millionths of a token, so that refills shorter
+         * than a token's worth of time still add up.
+         */
+        inline void accrue(int64_t& tokens,
+                           uint64_t& remainder,
+                           uint64_t elapsed,
+                           uint64_t rate)
+        {
+            remainder += elapsed * rate;
+            tokens += (int64_t)(remainder / 1000000);
+            remainder %= 1000000;
+
+            int64_t cap = burst(rate);
+            if (tokens > cap) {
+                tokens = cap;
+                remainder = 0;
+            }
+        }
+    }
+
+    IoScheduler::IoScheduler(Config const& config)
+      : config(config)
+    {
+        byte_tokens = burst(config.bytes_per_sec);
+        op_tokens = burst(config.ops_per_sec);
+    }
+
+    void IoScheduler::refill(uint64_t now)
+    {
+        uint64_t elapsed = now - last_refill_us;
+        last_refill_us = now;
+
+        if (elapsed > 1000000)
+            elapsed = 1000000;
+
+        if (config.bytes_per_sec)
+            accrue(byte_tokens, byte_remainder, elapsed, config.bytes_per_sec);
+
+        if (config.ops_per_sec)
+            accrue(op_tokens, op_remainder, elapsed, config.ops_per_sec);
+    }
+
+    void IoScheduler::idle(uint64_t us)
+    {
+        SquidSnapshot::squidutils->_timer.usleep(us);
+        stats.throttled_us += us;
+    }
+
+    uint64_t IoScheduler::admit(size_t bytes)
+    {
+        uint64_t now = SquidSnapshot::squidutils->_timer.elapsed_us();
+
+        stats.ops++;
+        stats.bytes += bytes;
+
+        if (urgent)
+            return now;
+
+        refill(now);
+
+        // INFO: Writes larger than the bucket only wait for a full bucket
+        // and leave it in debt, otherwise they would never be admitted.
+        int64_t need = (int64_t)bytes;
+        if (need > burst(config.bytes_per_sec))
+            need = burst(config.bytes_per_sec);
+
+        for (;;) {
+            uint64_t wait_us = 0;
+
+            if (config.bytes_per_sec)
+                wait_us = wait_for(byte_tokens, need, config.bytes_per_sec);
+
+            if (config.ops_per_sec) {
+                uint64_t ops_us = wait_for(op_tokens, 1, config.ops_per_sec);
+                if (ops_us > wait_us)
+                    wait_us = ops_us;
+            }
+
+            if (wait_us == 0)
+                break;
+
+            idle(wait_us);
+
+            now = SquidSnapshot::squidutils->_timer.elapsed_us();
+            refill(now);
+        }
+
+        byte_tokens -= (int64_t)bytes;
+        op_tokens -= 1;
+
+        return now;
+    }
+
+    void IoScheduler::complete(uint64_t start)
+    {
+        uint64_t now = SquidSnapshot::squidutils->_timer.elapsed_us();
+        uint64_t latency = now - start;
+
+        stats.latency_us =
+          stats.latency_us ? (stats.latency_us * 7 + latency) / 8 : latency;
+
+        if (urgent || config.latency_us == 0)
+            return;
+
+        if (now - last_adjust_us >= ADJUST_US) {
+            if (stats.latency_us > config.latency_us &&
+                stats.backoff < MAX_BACKOFF) {
+                stats.backoff++;
+                last_adjust_us = now;
+            } else if (stats.latency_us < config.latency_us / 2 &&
+                       stats.backoff > 0) {
+                stats.backoff--;
+                last_adjust_us = now;
+            }
+        }
+
+        if (stats.backoff)
+            idle(latency * ((1ULL << stats.backoff) - 1));
+    }
+}; // namespace SquidSnapshot
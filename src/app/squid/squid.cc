@@ -3,9 +3,7 @@
 #include "util/bit_array.h"
 
 #include <base/stdint.h>
-#include <os/vfs.h>
 #include <util/construct_at.h>
-#include <util/misc_math.h>
 #include <util/string.h>
 
 namespace SquidSnapshot {
@@ -19,11 +17,13 @@ namespace SquidSnapshot {
 
         freemask.set(0, ROOT_SIZE);
 
-        Genode::Directory::Path path = to_path();
+        // INFO: The squid root may not exist yet on a fresh file system.
+        SquidSnapshot::squidutils->createdir(Path("/", SQUIDROOT));
+
+        Path path = to_path();
         SquidSnapshot::squidutils->createdir(path);
 
-        if (!SquidSnapshot::squidutils->_vfs_env.root_dir().directory(
-              path.string())) {
+        if (!SquidSnapshot::squidutils->_storage.directory_exists(path)) {
 
             Genode::error(SQUID_ERROR_FMT "couldn't create directory: ", path);
         }
@@ -38,7 +38,7 @@ namespace SquidSnapshot {
         SquidSnapshot::squidutils->_heap.free(freelist, 0);
     }
 
-    Genode::Directory::Path SnapshotRoot::to_path(void)
+    Path SnapshotRoot::to_path(void)
     {
         Genode::String<1024> path("/", SQUIDROOT, "/current");
         return path;
@@ -73,7 +73,14 @@ namespace SquidSnapshot {
 
     void SnapshotRoot::return_entry(uint64_t index)
     {
-        freemask.set(index, 1);
+        if (!freemask.get(index, 1))
+            freemask.set(index, 1);
+    }
+
+    void SnapshotRoot::mark_full(uint64_t index)
+    {
+        if (freemask.get(index, 1))
+            freemask.clear(index, 1);
     }
 
     SquidFileHash* SnapshotRoot::get_hash(void)
@@ -104,6 +111,55 @@ namespace SquidSnapshot {
         return nullptr;
     }
 
+    SquidFileHash* SnapshotRoot::get_hash_near(uint64_t key)
+    {
+        // INFO: Probe forward from the slot of the key, one L2 directory at a
+        // time. Within a directory only higher file ids are considered, so
+        // that hashes handed out for ascending keys stay in ascending order.
+        uint64_t slot = key % HASH_COUNT;
+
+        for (uint64_t probed = 0; probed < HASH_COUNT;) {
+            uint64_t l1 = slot / (L1_SIZE * L2_SIZE);
+            uint64_t l2 = (slot / L2_SIZE) % L1_SIZE;
+            uint64_t file = slot % L2_SIZE;
+
+            SquidFileHash* hash =
+              freelist[l1].entry_at(l2)->get_entry_near(file);
+            if (hash != nullptr)
+                return hash;
+
+            probed += L2_SIZE - file;
+            slot = (slot + L2_SIZE - file) % HASH_COUNT;
+        }
+
+        return get_hash();
+    }
+
+    L2Dir* SnapshotRoot::_dir_of(uint64_t slot)
+    {
+        slot %= HASH_COUNT;
+
+        uint64_t l1 = slot / (L1_SIZE * L2_SIZE);
+        uint64_t l2 = (slot / L2_SIZE) % L1_SIZE;
+
+        return freelist[l1].entry_at(l2);
+    }
+
+    SquidFileHash* SnapshotRoot::hash_at(uint64_t slot)
+    {
+        return _dir_of(slot)->entry_at(slot % L2_SIZE);
+    }
+
+    void SnapshotRoot::reserve(uint64_t slot)
+    {
+        _dir_of(slot)->reserve(slot % L2_SIZE);
+    }
+
+    bool SnapshotRoot::is_taken(uint64_t slot)
+    {
+        return _dir_of(slot)->is_taken(slot % L2_SIZE);
+    }
+
     L1Dir::L1Dir(SnapshotRoot* parent, uint64_t l1)
       : freeindex(0)
       , freemask()
@@ -115,7 +171,7 @@ namespace SquidSnapshot {
 
         freemask.set(0, L1_SIZE);
 
-        Genode::Directory::Path path = to_path();
+        Path path = to_path();
         SquidSnapshot::squidutils->createdir(path);
 
         for (uint64_t i = 0; i < L1_SIZE; i++) {
@@ -129,7 +185,7 @@ namespace SquidSnapshot {
         parent->return_entry(l1_dir);
     }
 
-    Genode::Directory::Path L1Dir::to_path(void)
+    Path L1Dir::to_path(void)
     {
         Genode::String<1024> path(parent->to_path(), "/", l1_dir);
         return path;
@@ -163,14 +219,32 @@ namespace SquidSnapshot {
         return nullptr;
     }
 
+    L2Dir* L1Dir::entry_at(uint64_t index)
+    {
+        return &freelist[index % L1_SIZE];
+    }
+
     void L1Dir::return_entry(uint64_t index)
     {
-        freemask.set(index, 1);
+        if (!freemask.get(index, 1))
+            freemask.set(index, 1);
+
+        parent->return_entry(l1_dir);
+    }
+
+    void L1Dir::mark_full(uint64_t index)
+    {
+        if (freemask.get(index, 1))
+            freemask.clear(index, 1);
+
+        if (is_full())
+            parent->mark_full(l1_dir);
     }
 
     L2Dir::L2Dir(L1Dir* parent, uint64_t l1, uint64_t l2)
       : freeindex(0)
       , freemask()
+      , reserved()
       , l1_dir(l1)
       , l2_dir(l2)
       , parent(parent)
@@ -180,7 +254,7 @@ namespace SquidSnapshot {
 
         freemask.set(0, L2_SIZE);
 
-        Genode::Directory::Path path = to_path();
+        Path path = to_path();
         SquidSnapshot::squidutils->createdir(path);
 
         for (uint64_t i = 0; i < L2_SIZE; i++) {
@@ -194,7 +268,7 @@ namespace SquidSnapshot {
         parent->return_entry(l2_dir);
     }
 
-    Genode::Directory::Path L2Dir::to_path(void)
+    Path L2Dir::to_path(void)
     {
         Genode::String<1024> path(parent->to_path(), "/", l2_dir);
         return path;
@@ -213,6 +287,7 @@ namespace SquidSnapshot {
         for (;; freeindex = (freeindex + 1) % L2_SIZE) {
             if (freemask.get(freeindex, 1)) {
                 freemask.clear(freeindex, 1);
+                freelist[freeindex].is_valid = true;
 
                 return &freelist[freeindex];
             }
@@ -221,9 +296,70 @@ namespace SquidSnapshot {
         return nullptr;
     }
 
+    SquidFileHash* L2Dir::get_entry_near(uint64_t index)
+    {
+        for (; index < L2_SIZE; index++) {
+            if (freemask.get(index, 1))
+                return _take(index);
+        }
+
+        return nullptr;
+    }
+
+    SquidFileHash* L2Dir::entry_at(uint64_t index)
+    {
+        index %= L2_SIZE;
+
+        if (freemask.get(index, 1))
+            return _take(index);
+
+        // INFO: A hash handed out is owned by its holder, a second one
+        // would write over its files.
+        if (!reserved.get(index, 1))
+            return nullptr;
+
+        reserved.clear(index, 1);
+        return &freelist[index];
+    }
+
+    void L2Dir::reserve(uint64_t index)
+    {
+        index %= L2_SIZE;
+
+        if (freemask.get(index, 1)) {
+            _take(index);
+            reserved.set(index, 1);
+        }
+    }
+
+    bool L2Dir::is_taken(uint64_t index)
+    {
+        index %= L2_SIZE;
+
+        return !freemask.get(index, 1) && !reserved.get(index, 1);
+    }
+
+    SquidFileHash* L2Dir::_take(uint64_t index)
+    {
+        freemask.clear(index, 1);
+        freelist[index].is_valid = true;
+
+        // INFO: Unlike get_entry(), these paths are not driven by the
+        // parents, so they would keep advertising this directory as free
+        // after its last hash is gone.
+        if (is_full())
+            parent->mark_full(l2_dir);
+
+        return &freelist[index];
+    }
+
     void L2Dir::return_entry(uint64_t index)
     {
         freemask.set(index, 1);
+
+        // INFO: The parents clear their bit once this directory is full,
+        // they have to learn that it has a free hash again.
+        parent->return_entry(l2_dir);
     }
 
     SquidFileHash::SquidFileHash(L2Dir* parent,
@@ -242,20 +378,79 @@ namespace SquidSnapshot {
         if (!is_valid)
             return Error::InvalidHash;
 
-        try {
-            New_file file(SquidSnapshot::squidutils->_root_dir, to_path());
+        if (staged != 0)
+            SquidSnapshot::global_squid->flush();
+
+        return write_file(payload, size);
+    }
+
+    Error SquidFileHash::write_file(void const* payload, size_t size)
+    {
+        if (!is_valid)
+            return Error::InvalidHash;
 
-            if (file.append((const char*)payload, size) !=
-                New_file::Append_result::OK) {
+        char const* data = (char const*)payload;
 
+        if (SquidSnapshot::squidutils->encrypted()) {
+            if (size > MAX_PAYLOAD_SIZE)
                 return Error::WriteFile;
-            }
 
-        } catch (New_file::Create_failed) {
-            return Error::CreateFile;
+            SquidUtils* utils = SquidSnapshot::squidutils;
+
+            size = utils->seal(slot(), payload, size, utils->_crypt_buffer);
+            data = (char const*)utils->_crypt_buffer;
         }
 
-        return Error::None;
+        return write_raw(data, size);
+    }
+
+    Error SquidFileHash::write_raw(void const* data, size_t size)
+    {
+        Main& squid = *SquidSnapshot::global_squid;
+        SquidUtils& utils = *SquidSnapshot::squidutils;
+        HotPack& hot_pack = squid.hot_pack;
+
+        uint64_t const slot = this->slot();
+
+        // INFO: Within a snapshot a hash is held either by the HotPack or
+        // by its squid file, the other copy is dropped whenever a write
+        // switches between them, e.g. for payloads too large for a record.
+        bool const packed =
+          squid.classifier.is_hot(slot) && size <= HotPack::RECORD_SIZE;
+
+        IoScheduler& io = squid.io_scheduler;
+        uint64_t start = io.admit(size);
+
+        Error result = Error::None;
+
+        if (packed) {
+            if (file_epoch == squid.epoch && !hot_pack.contains(slot))
+                result = utils.remove(to_path());
+
+            if (result == Error::None)
+                result = hot_pack.write(slot, data, size);
+        } else {
+            if (hot_pack.contains(slot))
+                result = hot_pack.remove(slot);
+
+            if (result == Error::None)
+                result = utils._storage.write(to_path(), data, size);
+        }
+
+        io.complete(start);
+
+        if (result == Error::None)
+            wrote(size);
+
+        return result;
+    }
+
+    void SquidFileHash::wrote(size_t size)
+    {
+        file_size = (uint32_t)size;
+        file_epoch = SquidSnapshot::global_squid->epoch;
+
+        SquidSnapshot::global_squid->classifier.note_write(slot());
     }
 
     Error SquidFileHash::read(void* payload)
@@ -263,23 +458,80 @@ namespace SquidSnapshot {
         if (!is_valid)
             return Error::InvalidHash;
 
-        Readonly_file file(SquidSnapshot::squidutils->_root_dir, to_path());
-        Readonly_file::At at{ 0 };
+        if (staged != 0)
+            SquidSnapshot::global_squid->flush();
 
-        Byte_range_ptr buffer((char*)payload, 1024);
+        Main& squid = *SquidSnapshot::global_squid;
+        Path current = squid.root_manager.to_path();
 
-        try {
-            for (;;) {
-                size_t const read_bytes = file.read(at, buffer);
+        // INFO: The pack is read through its header on disk.
+        if (squid.hot_pack.contains(slot())) {
+            Error err = squid.hot_pack.sync();
+            if (err != Error::None)
+                return err;
 
-                at.value += read_bytes;
+            return read_from(current, true, payload);
+        }
 
-                if (read_bytes < buffer.num_bytes)
-                    break;
-            }
-        } catch (...) {
+        // INFO: Hashes not written in the current snapshot are read from
+        // the newest completed snapshot that has them.
+        uint64_t id = 0;
+        if (!SquidSnapshot::squidutils->exists(to_path()) &&
+            squid.history.newest_with(slot(), id))
+            return read_from(SnapshotHistory::to_path(id),
+                             squid.history.is_packed(id, slot()),
+                             payload);
+
+        return read_from(current, false, payload);
+    }
+
+    Error SquidFileHash::read_at(uint64_t snapshot, void* payload)
+    {
+        if (!is_valid)
+            return Error::InvalidHash;
+
+        SnapshotHistory& history = SquidSnapshot::global_squid->history;
+
+        uint64_t id = 0;
+        if (!history.contains(snapshot) ||
+            !history.newest_with(slot(), id, snapshot))
             return Error::ReadFile;
-        }
+
+        return read_from(
+          SnapshotHistory::to_path(id), history.is_packed(id, slot()), payload);
+    }
+
+    Error SquidFileHash::read_from(Path const& snapshot,
+                                   bool packed,
+                                   void* payload)
+    {
+        if (SquidSnapshot::squidutils->encrypted())
+            return read_encrypted(snapshot, packed, payload);
+
+        // INFO: Plaintext squid files are not bounded by MAX_PAYLOAD_SIZE,
+        // the caller's buffer has to hold the whole file.
+        size_t size = 0;
+        return SquidSnapshot::squidutils->read_file(
+          snapshot, slot(), packed, payload, ~(size_t)0, size);
+    }
+
+    Error SquidFileHash::read_encrypted(Path const& snapshot,
+                                        bool packed,
+                                        void* payload)
+    {
+        SquidUtils* utils = SquidSnapshot::squidutils;
+
+        size_t size = 0;
+        if (utils->read_file(snapshot,
+                             slot(),
+                             packed,
+                             utils->_crypt_buffer,
+                             MAX_PAYLOAD_SIZE + Cipher::OVERHEAD,
+                             size) != Error::None)
+            return Error::ReadFile;
+
+        if (!utils->open(slot(), size, payload))
+            return Error::CorruptedFile;
 
         return Error::None;
     }
@@ -288,9 +540,15 @@ namespace SquidSnapshot {
     {
         parent->return_entry(file_id);
         is_valid = false;
+        generation++;
+    }
+
+    uint64_t SquidFileHash::slot(void)
+    {
+        return (l1_dir * L1_SIZE + l2_dir) * L2_SIZE + file_id;
     }
 
-    Genode::Directory::Path SquidFileHash::to_path(void)
+    Path SquidFileHash::to_path(void)
     {
         if (!is_valid)
             throw InvalidHash();
@@ -299,49 +557,502 @@ namespace SquidSnapshot {
         return hash;
     }
 
-    void SquidUtils::createdir(const Genode::Directory::Path& path)
+    Path SquidFileHash::to_path(Path const& snapshot)
     {
-        Vfs::Vfs_handle* handle = nullptr;
-        auto res = squidutils->_vfs_env.root_dir().opendir(
-          path.string(), true, &handle, _heap);
+        return hash_path(snapshot, slot());
+    }
+
+    Path hash_path(Path const& snapshot, uint64_t slot)
+    {
+        uint64_t l1 = slot / (L1_SIZE * L2_SIZE);
+        uint64_t l2 = (slot / L2_SIZE) % L1_SIZE;
+        uint64_t file = slot % L2_SIZE;
 
-        if (res != Vfs::Directory_service::OPENDIR_ERR_NODE_ALREADY_EXISTS &&
-            res != Vfs::Directory_service::OPENDIR_OK) {
+        Genode::String<1024> hash(snapshot, "/", l1, "/", l2, "/", file);
+        return hash;
+    }
+
+    void SquidUtils::createdir(const Path& path)
+    {
+        if (_storage.create_dir(path) != Error::None) {
             Genode::error("Couldn't open directory: ", path);
 
-            if (res == Vfs::Directory_service::OPENDIR_ERR_PERMISSION_DENIED)
-                Genode::error("reason: permission");
+            throw Genode::Exception();
+        }
+    }
+
+    void SquidUtils::_init_encryption(void)
+    {
+        if (!_config.has_node("encryption"))
+            return;
+
+        uint32_t id = config_value("encryption", "id", 0U);
+
+        uint8_t key[Cipher::KEY_SIZE];
+        if (!_load_key(id, key)) {
+            Genode::error(SQUID_ERROR_FMT "invalid encryption key, expected ",
+                          2 * Cipher::KEY_SIZE,
+                          " hex digits");
 
             throw Genode::Exception();
         }
 
-        if (handle)
-            handle->close();
+        set_key(key, id);
+
+        for (size_t i = 0; i < Cipher::KEY_SIZE; i++)
+            ((volatile uint8_t*)key)[i] = 0;
+    }
+
+    bool SquidUtils::_load_key(uint32_t id, uint8_t key[Cipher::KEY_SIZE])
+    {
+        typedef String<2 * Cipher::KEY_SIZE + 1> Key_string;
+        Key_string hex;
+
+        bool const active = id == config_value("encryption", "id", 0U);
+
+        String<16> const attr = active ? String<16>("key")
+                                       : String<16>("key", id);
+
+        ConfigSource::Value value;
+        if (_config.attribute("encryption", attr.string(), value))
+            hex = Key_string(value);
+
+        if (_config.attribute("encryption", "rom", value)) {
+            String<128> name = active ? String<128>(value)
+                                      : String<128>(value, ".", id);
+
+            char rom[2 * Cipher::KEY_SIZE];
+            size_t size = _config.module(name.string(), rom, sizeof(rom));
+
+            if (size != 0)
+                hex = Key_string(Cstring(rom, size));
+        }
+
+        return Cipher::parse_key(hex.string(), key);
+    }
+
+    void SquidUtils::set_key(uint8_t const key[Cipher::KEY_SIZE], uint32_t id)
+    {
+        if (_crypt_buffer == nullptr)
+            _crypt_buffer = (uint8_t*)_heap.alloc(MAX_PAYLOAD_SIZE +
+                                                  Cipher::OVERHEAD);
+
+        clear_key();
+
+        _master.construct(key);
+        _master_id = id;
+
+        if (!_master->is_accelerated())
+            Genode::warning("squid: no AES-NI, using portable encryption");
+
+        rotate_key();
+    }
+
+    void SquidUtils::clear_key(void)
+    {
+        _cipher.destruct();
+        _master.destruct();
+
+        for (unsigned i = 0; i < KEY_CACHE; i++)
+            _keys[i].cipher.destruct();
+    }
+
+    void SquidUtils::rotate_key(void)
+    {
+        if (!_master.constructed())
+            return;
+
+        // INFO: The clock restarts with every boot, so snapshot keys are
+        // numbered by a counter in the squid root instead. The number is
+        // stored before its key is used, so no key is ever derived twice
+        // and its nonces may start over at 0.
+        uint32_t number = 0;
+        if (_claim_key_number(number) != Error::None) {
+            if (_cipher.constructed()) {
+                Genode::error(SQUID_ERROR_FMT "couldn't store the key "
+                                              "number, keeping the key");
+                return;
+            }
+
+            Genode::error(SQUID_ERROR_FMT "couldn't store the key number");
+            throw Genode::Exception();
+        }
+
+        uint8_t key[Cipher::KEY_SIZE];
+        _master->derive(_master_id, number, key);
+
+        _cipher.construct(key);
+        _key_number = number;
+
+        for (size_t i = 0; i < Cipher::KEY_SIZE; i++)
+            ((volatile uint8_t*)key)[i] = 0;
+
+        _nonce_counter = 0;
+    }
+
+    Cipher* SquidUtils::_snapshot_key(uint32_t master_id, uint32_t number)
+    {
+        if (master_id == _master_id && number == _key_number)
+            return &*_cipher;
+
+        for (unsigned i = 0; i < KEY_CACHE; i++) {
+            Snapshot_key& cached = _keys[i];
+
+            if (cached.cipher.constructed() &&
+                cached.master_id == master_id && cached.number == number)
+                return &*cached.cipher;
+        }
+
+        uint8_t key[Cipher::KEY_SIZE];
+
+        if (master_id == _master_id) {
+            _master->derive(master_id, number, key);
+        } else {
+            uint8_t retired[Cipher::KEY_SIZE];
+            if (!_load_key(master_id, retired)) {
+                Genode::error(SQUID_ERROR_FMT "master key ",
+                              master_id,
+                              " is not configured");
+                return nullptr;
+            }
+
+            Cipher(retired).derive(master_id, number, key);
+
+            for (size_t i = 0; i < Cipher::KEY_SIZE; i++)
+                ((volatile uint8_t*)retired)[i] = 0;
+        }
+
+        Snapshot_key& slot = _keys[_keys_next];
+        _keys_next = (_keys_next + 1) % KEY_CACHE;
+
+        slot.cipher.construct(key);
+        slot.master_id = master_id;
+        slot.number = number;
+
+        for (size_t i = 0; i < Cipher::KEY_SIZE; i++)
+            ((volatile uint8_t*)key)[i] = 0;
+
+        return &*slot.cipher;
+    }
+
+    namespace {
+        void store_le32(uint8_t* p, uint32_t v)
+        {
+            for (unsigned i = 0; i < 4; i++)
+                p[i] = (uint8_t)(v >> (8 * i));
+        }
+
+        uint32_t load_le32(uint8_t const* p)
+        {
+            uint32_t v = 0;
+            for (unsigned i = 0; i < 4; i++)
+                v |= (uint32_t)p[i] << (8 * i);
+
+            return v;
+        }
+
+        /**
+         * @brief Slot and key id, authenticated along with the ciphertext.
+         */
+        void fill_aad(uint8_t aad[8 + Cipher::KEY_ID_SIZE],
+                      uint64_t slot,
+                      uint8_t const key_id[Cipher::KEY_ID_SIZE])
+        {
+            for (unsigned i = 0; i < 8; i++)
+                aad[i] = (uint8_t)(slot >> (8 * i));
+
+            __builtin_memcpy(aad + 8, key_id, Cipher::KEY_ID_SIZE);
+        }
+    }
+
+    Error SquidUtils::_claim_key_number(uint32_t& number)
+    {
+        Path const path("/", SQUIDROOT, "/key.seq");
+
+        uint8_t stored[4] = { 0, 0, 0, 0 };
+        size_t size = 0;
+        if (_storage.file_exists(path) &&
+            (_storage.read(path, stored, sizeof(stored), size) !=
+               Error::None ||
+             size != sizeof(stored)))
+            return Error::ReadFile;
+
+        number = load_le32(stored) + 1;
+        if (number <= _key_number)
+            number = _key_number + 1;
+
+        store_le32(stored, number);
+
+        // INFO: The squid root may not exist yet, keys are set up before
+        // the snapshot root.
+        if (_storage.create_dir(Path("/", SQUIDROOT)) != Error::None)
+            return Error::CreateFile;
+
+        return _storage.write(path, stored, sizeof(stored));
+    }
+
+    size_t SquidUtils::seal(uint64_t slot,
+                            void const* payload,
+                            size_t size,
+                            uint8_t* out)
+    {
+        uint8_t* key_id = out + size;
+        uint8_t* nonce = key_id + Cipher::KEY_ID_SIZE;
+        uint8_t* tag = nonce + Cipher::NONCE_SIZE;
+
+        store_le32(key_id, _master_id);
+        store_le32(key_id + 4, _key_number);
+
+        // INFO: Keys are never reused, so the counter alone keeps nonces
+        // unique, the leading bytes stay zero.
+        store_le32(nonce, 0);
+
+        // INFO: Atomic, as the workers of the ParallelWriter seal
+        // concurrently.
+        uint64_t counter =
+          __atomic_fetch_add(&_nonce_counter, 1, __ATOMIC_RELAXED);
+        for (unsigned i = 0; i < 8; i++)
+            nonce[4 + i] = (uint8_t)(counter >> (8 * i));
+
+        uint8_t aad[8 + Cipher::KEY_ID_SIZE];
+        fill_aad(aad, slot, key_id);
+
+        _cipher->seal(nonce,
+                      aad,
+                      sizeof(aad),
+                      (uint8_t const*)payload,
+                      out,
+                      size,
+                      tag);
+
+        return size + Cipher::OVERHEAD;
+    }
+
+    bool SquidUtils::open(uint64_t slot, size_t file_size, void* payload)
+    {
+        if (file_size < Cipher::OVERHEAD)
+            return false;
+
+        size_t size = file_size - Cipher::OVERHEAD;
+        uint8_t const* key_id = _crypt_buffer + size;
+        uint8_t const* nonce = key_id + Cipher::KEY_ID_SIZE;
+        uint8_t const* tag = nonce + Cipher::NONCE_SIZE;
+
+        Cipher* cipher =
+          _snapshot_key(load_le32(key_id), load_le32(key_id + 4));
+        if (cipher == nullptr)
+            return false;
+
+        uint8_t aad[8 + Cipher::KEY_ID_SIZE];
+        fill_aad(aad, slot, key_id);
+
+        return cipher->open(nonce,
+                            aad,
+                            sizeof(aad),
+                            _crypt_buffer,
+                            (uint8_t*)payload,
+                            size,
+                            tag);
+    }
+
+    size_t SquidUtils::staging_size(void)
+    {
+        return config_value("staging", "size", Number_of_bytes(STAGING_SIZE));
+    }
+
+    IoScheduler::Config SquidUtils::io_config(void)
+    {
+        IoScheduler::Config config{ 0, 0, 0 };
+
+        config.bytes_per_sec =
+          config_value("io", "bytes_per_sec", Number_of_bytes(0));
+        config.ops_per_sec = config_value("io", "ops_per_sec", 0ULL);
+        config.latency_us = config_value("io", "latency_us", 0ULL);
+
+        return config;
+    }
+
+    SquidUtils::Compaction_config SquidUtils::compaction_config(void)
+    {
+        Compaction_config config{ 0, 64 };
+
+        config.keep = config_value("compaction", "keep", config.keep);
+        config.budget = config_value("compaction", "budget", config.budget);
+
+        return config;
+    }
+
+    ParallelWriter::Config SquidUtils::parallel_config(void)
+    {
+        ParallelWriter::Config config{ 0, 0, 1024 * 1024 };
+
+        config.workers = config_value("parallel", "workers", config.workers);
+        config.cpu = config_value("parallel", "cpu", config.cpu);
+        config.buffer =
+          config_value("parallel", "buffer", Number_of_bytes(config.buffer));
+
+        return config;
+    }
+
+    Classifier::Config SquidUtils::classify_config(void)
+    {
+        // INFO: The HotPack is opt-in, it changes the on-disk layout of
+        // the snapshots.
+        Classifier::Config config{ 0, 4 };
+
+        config.hot = config_value("classify", "hot", config.hot);
+        config.cold = config_value("classify", "cold", config.cold);
+
+        return config;
+    }
+
+    Error SquidUtils::read_file(Path const& snapshot,
+                                uint64_t slot,
+                                bool packed,
+                                void* data,
+                                size_t capacity,
+                                size_t& size)
+    {
+        if (packed)
+            return HotPack::read(snapshot, slot, data, capacity, size);
+
+        return _storage.read(hash_path(snapshot, slot), data, capacity, size);
+    }
+
+    void SquidUtils::createtree(Path const& root)
+    {
+        createdir(root);
+
+        for (uint64_t l1 = 0; l1 < ROOT_SIZE; l1++) {
+            createdir(Path(root, "/", l1));
+
+            for (uint64_t l2 = 0; l2 < L1_SIZE; l2++)
+                createdir(Path(root, "/", l1, "/", l2));
+        }
+    }
+
+    void SquidUtils::removetree(Path const& root)
+    {
+        // INFO: Squid files first, then the L2, L1 and root directories, so
+        // that directories are empty when removed.
+        for (uint64_t slot = 0; slot < HASH_COUNT; slot++)
+            remove(hash_path(root, slot));
+
+        remove(HotPack::to_path(root));
+
+        for (uint64_t l1 = 0; l1 < ROOT_SIZE; l1++) {
+            for (uint64_t l2 = 0; l2 < L1_SIZE; l2++)
+                remove(Path(root, "/", l1, "/", l2));
+
+            remove(Path(root, "/", l1));
+        }
+
+        if (remove(root) != Error::None)
+            Genode::warning("squid: couldn't remove ", root);
+    }
+
+    bool SquidUtils::exists(Path const& path)
+    {
+        return _storage.file_exists(path);
+    }
+
+    Error SquidUtils::remove(Path const& path)
+    {
+        return _storage.unlink(path);
     }
 
-    Main::Main(SquidSnapshot::SquidUtils*)
+    Error SquidUtils::copy(Path const& from, Path const& to)
+    {
+        return _storage.copy(from, to);
+    }
+
+    Error SquidUtils::rename(Path const& from, Path const& to)
+    {
+        return _storage.rename(from, to);
+    }
+
+    Main::Main(SquidSnapshot::SquidUtils* utils)
+      : staging(utils->staging_size())
+      , io_scheduler(utils->io_config())
+      , classifier(utils->classify_config(), history)
     {
         construct_at<SquidSnapshot::SnapshotRoot>(&root_manager);
+
+        history.scan();
+        classifier.scan();
+        hot_pack.resume(root_manager.to_path());
+
+        ParallelWriter::Config config = utils->parallel_config();
+        if (config.workers != 0)
+            parallel.construct(utils->_backend, config);
+    }
+
+    Error Main::flush(void)
+    {
+        Error result = staging.drain();
+
+        if (parallel.constructed()) {
+            Error err = parallel->join();
+
+            if (result == Error::None)
+                result = err;
+        }
+
+        Error err = hot_pack.sync();
+        if (result == Error::None)
+            result = err;
+
+        return result;
     }
 
     void Main::finish(void)
     {
-        Genode::int64_t timestamp =
-          SquidSnapshot::squidutils->_timer.curr_time()
-            .trunc_to_plain_us()
-            .value;
+        if (flush() != Error::None)
+            Genode::error(SQUID_ERROR_FMT "failed to write pending payloads");
+
+        // INFO: Files of deleted hashes must not end up in the snapshot.
+        reclaimer.step();
+
+        if (hot_pack.sync() != Error::None)
+            Genode::error(SQUID_ERROR_FMT "failed to write the hot pack");
+
+        Genode::uint64_t timestamp =
+          history.next_id(SquidSnapshot::squidutils->_timer.curr_time_us());
 
         Genode::String<1024> snapshot_timestamp("/", SQUIDROOT, "/", timestamp);
         Genode::String<1024> snapshot_current("/", SQUIDROOT, "/current");
 
-        // char snapshot_current[1024];
-        // Format::snprintf(snapshot_current, 1024, "/%s/current", SQUIDROOT);
-
-        if (SquidSnapshot::squidutils->_vfs_env.root_dir().rename(
-              snapshot_current.string(), snapshot_timestamp.string()) ==
-            Vfs::Directory_service::RENAME_ERR_NO_ENTRY) {
+        if (SquidSnapshot::squidutils->rename(snapshot_current,
+                                              snapshot_timestamp) !=
+            Error::None) {
             Genode::error("rename no good!");
+            return;
         }
+
+        if (!history.add(timestamp))
+            Genode::error(SQUID_ERROR_FMT "too many snapshots, compact them");
+
+        epoch++;
+
+        SquidSnapshot::squidutils->rotate_key();
+
+        classifier.advance();
+        hot_pack.reset();
+
+        // INFO: The next snapshot only holds the squid files written from
+        // now on, everything else is found in the completed snapshots.
+        SquidSnapshot::squidutils->createtree(root_manager.to_path());
+
+        SquidUtils::Compaction_config compaction =
+          SquidSnapshot::squidutils->compaction_config();
+
+        if (compaction.keep != 0 && history.size() > compaction.keep &&
+            !compactor.is_running())
+            compactor.start(history.at(0),
+                            history.at(history.size() - compaction.keep));
+
+        if (compactor.is_running())
+            compactor.step(compaction.budget);
     }
 
     Error Main::test(void)
@@ -410,6 +1121,28 @@ extern "C"
         SquidSnapshot::SquidFileHash* squid_generated_hash =
           SquidSnapshot::global_squid->root_manager.get_hash();
 
+        // INFO: Only wait for the reclamation of deleted hashes if there
+        // are no free ones left.
+        if (squid_generated_hash == nullptr)
+            squid_generated_hash =
+              SquidSnapshot::global_squid->reclaimer.take();
+
+        if (squid_generated_hash == nullptr)
+            return SQUID_FULL;
+
+        *hash = (void*)squid_generated_hash;
+        return SQUID_NONE;
+    }
+
+    enum SquidError squid_hash_near(void** hash, unsigned long long key)
+    {
+        SquidSnapshot::SquidFileHash* squid_generated_hash =
+          SquidSnapshot::global_squid->root_manager.get_hash_near(key);
+
+        if (squid_generated_hash == nullptr)
+            squid_generated_hash =
+              SquidSnapshot::global_squid->reclaimer.take();
+
         if (squid_generated_hash == nullptr)
             return SQUID_FULL;
 
@@ -425,6 +1158,74 @@ extern "C"
           (SquidSnapshot::SquidFileHash*)hash;
 
         switch (squid_file->write(payload, size)) {
+            case SquidSnapshot::Error::InvalidHash:
+                return SQUID_INVALID;
+
+            case SquidSnapshot::Error::CreateFile:
+                return SQUID_CREATE;
+
+            case SquidSnapshot::Error::WriteFile:
+                return SQUID_WRITE;
+
+            default:
+                return SQUID_NONE;
+        }
+    }
+
+    enum SquidError squid_stage(void* hash,
+                                void* payload,
+                                unsigned long long size)
+    {
+        SquidSnapshot::SquidFileHash* squid_file =
+          (SquidSnapshot::SquidFileHash*)hash;
+
+        switch (SquidSnapshot::global_squid->staging.stage(
+          squid_file, payload, size)) {
+            case SquidSnapshot::Error::InvalidHash:
+                return SQUID_INVALID;
+
+            case SquidSnapshot::Error::CreateFile:
+                return SQUID_CREATE;
+
+            case SquidSnapshot::Error::WriteFile:
+                return SQUID_WRITE;
+
+            default:
+                return SQUID_NONE;
+        }
+    }
+
+    enum SquidError squid_drain(unsigned long long budget)
+    {
+        switch (SquidSnapshot::global_squid->staging.drain(budget)) {
+            case SquidSnapshot::Error::CreateFile:
+                return SQUID_CREATE;
+
+            case SquidSnapshot::Error::WriteFile:
+                return SQUID_WRITE;
+
+            default:
+                return SQUID_NONE;
+        }
+    }
+
+    enum SquidError squid_submit(void* hash,
+                                 void* payload,
+                                 unsigned long long size)
+    {
+        SquidSnapshot::SquidFileHash* squid_file =
+          (SquidSnapshot::SquidFileHash*)hash;
+
+        SquidSnapshot::Error err =
+          SquidSnapshot::global_squid->parallel.constructed()
+            ? SquidSnapshot::global_squid->parallel->submit(
+                squid_file, payload, size)
+            : squid_file->write(payload, size);
+
+        switch (err) {
+            case SquidSnapshot::Error::InvalidHash:
+                return SQUID_INVALID;
+
             case SquidSnapshot::Error::CreateFile:
                 return SQUID_CREATE;
 
@@ -436,34 +1237,355 @@ extern "C"
         }
     }
 
+    enum SquidError squid_join(void)
+    {
+        if (!SquidSnapshot::global_squid->parallel.constructed())
+            return SQUID_NONE;
+
+        SquidSnapshot::Main& squid = *SquidSnapshot::global_squid;
+
+        SquidSnapshot::Error err = squid.parallel->join();
+        if (err == SquidSnapshot::Error::None)
+            err = squid.hot_pack.sync();
+
+        switch (err) {
+            case SquidSnapshot::Error::CreateFile:
+                return SQUID_CREATE;
+
+            case SquidSnapshot::Error::WriteFile:
+                return SQUID_WRITE;
+
+            default:
+                return SQUID_NONE;
+        }
+    }
+
+    enum SquidError squid_stats(struct SquidStats* stats)
+    {
+        SquidSnapshot::StagingRing::Stats const& staging =
+          SquidSnapshot::global_squid->staging.statistics();
+
+        stats->staging_capacity = staging.capacity;
+        stats->staging_used = staging.used;
+        stats->staging_high_water = staging.high_water;
+        stats->staging_entries = staging.entries;
+        stats->staging_overflows = staging.overflows;
+        stats->staging_dropped = staging.dropped;
+        stats->staged_bytes = staging.staged_bytes;
+        stats->drained_bytes = staging.drained_bytes;
+        stats->drain_rate =
+          staging.drain_us ? staging.drained_bytes * 1000000 / staging.drain_us
+                           : 0;
+
+        SquidSnapshot::IoScheduler::Stats const& io =
+          SquidSnapshot::global_squid->io_scheduler.statistics();
+
+        stats->io_ops = io.ops;
+        stats->io_bytes = io.bytes;
+        stats->io_throttled_us = io.throttled_us;
+        stats->io_latency_us = io.latency_us;
+        stats->io_backoff = io.backoff;
+
+        stats->compaction_remaining =
+          SquidSnapshot::global_squid->compactor.remaining();
+
+        SquidSnapshot::Reclaimer::Stats const& reclaim =
+          SquidSnapshot::global_squid->reclaimer.statistics();
+
+        stats->reclaim_pending = reclaim.pending;
+        stats->reclaim_dead_bytes = reclaim.dead_bytes;
+        stats->reclaimed = reclaim.reclaimed;
+        stats->reclaimed_bytes = reclaim.reclaimed_bytes;
+        stats->reclaim_batches = reclaim.batches;
+
+        SquidSnapshot::Classifier::Stats const& classify =
+          SquidSnapshot::global_squid->classifier.statistics();
+        SquidSnapshot::HotPack::Stats const& hot_pack =
+          SquidSnapshot::global_squid->hot_pack.statistics();
+
+        stats->classify_hot = classify.hot;
+        stats->classify_cold = classify.cold;
+        stats->hot_pack_records = hot_pack.records;
+        stats->hot_pack_writes = hot_pack.writes;
+        stats->hot_pack_bytes = hot_pack.bytes;
+
+        if (SquidSnapshot::global_squid->parallel.constructed()) {
+            SquidSnapshot::ParallelWriter::Stats const& parallel =
+              SquidSnapshot::global_squid->parallel->statistics();
+
+            stats->parallel_workers = parallel.workers;
+            stats->parallel_jobs = parallel.jobs;
+            stats->parallel_joins = parallel.joins;
+            stats->parallel_prepare_us = parallel.prepare_us;
+            stats->parallel_write_us = parallel.write_us;
+        } else {
+            stats->parallel_workers = 0;
+            stats->parallel_jobs = 0;
+            stats->parallel_joins = 0;
+            stats->parallel_prepare_us = 0;
+            stats->parallel_write_us = 0;
+        }
+
+        return SQUID_NONE;
+    }
+
     enum SquidError squid_read(void* hash, void* payload)
     {
         SquidSnapshot::SquidFileHash* squid_file =
           (SquidSnapshot::SquidFileHash*)hash;
 
         switch (squid_file->read(payload)) {
+            case SquidSnapshot::Error::InvalidHash:
+                return SQUID_INVALID;
+
+            case SquidSnapshot::Error::ReadFile:
+                return SQUID_READ;
+
+            case SquidSnapshot::Error::CorruptedFile:
+                return SQUID_CORRUPTED;
+
+            default:
+                return SQUID_NONE;
+        }
+    }
+
+    enum SquidError squid_read_at(void* hash,
+                                  unsigned long long snapshot,
+                                  void* payload)
+    {
+        SquidSnapshot::SquidFileHash* squid_file =
+          (SquidSnapshot::SquidFileHash*)hash;
+
+        switch (squid_file->read_at(snapshot, payload)) {
+            case SquidSnapshot::Error::InvalidHash:
+                return SQUID_INVALID;
+
             case SquidSnapshot::Error::ReadFile:
                 return SQUID_READ;
 
+            case SquidSnapshot::Error::CorruptedFile:
+                return SQUID_CORRUPTED;
+
             default:
                 return SQUID_NONE;
         }
     }
 
+    enum SquidError squid_snapshots_with(void* hash,
+                                         unsigned long long* snapshots,
+                                         unsigned long long max,
+                                         unsigned long long* count)
+    {
+        SquidSnapshot::SquidFileHash* squid_file =
+          (SquidSnapshot::SquidFileHash*)hash;
+
+        if (!squid_file->is_valid)
+            return SQUID_INVALID;
+
+        Genode::uint64_t ids[SquidSnapshot::SnapshotHistory::MAX_SNAPSHOTS];
+
+        *count = SquidSnapshot::global_squid->history.snapshots_with(
+          squid_file->slot(),
+          ids,
+          SquidSnapshot::SnapshotHistory::MAX_SNAPSHOTS);
+
+        for (unsigned long long i = 0; i < *count && i < max; i++)
+            snapshots[i] = ids[i];
+
+        return SQUID_NONE;
+    }
+
     enum SquidError squid_delete(void* hash)
     {
         SquidSnapshot::SquidFileHash* file =
           (SquidSnapshot::SquidFileHash*)hash;
 
-        try {
-            file->return_entry();
-        } catch (...) {
+        if (SquidSnapshot::global_squid->reclaimer.defer(file) !=
+            SquidSnapshot::Error::None)
             return SQUID_DELETE;
+
+        return SQUID_NONE;
+    }
+
+    enum SquidError squid_reclaim(unsigned long long budget)
+    {
+        SquidSnapshot::global_squid->reclaimer.step(budget);
+        return SQUID_NONE;
+    }
+
+    enum SquidError squid_compact(unsigned long long from,
+                                  unsigned long long to)
+    {
+        if (!SquidSnapshot::global_squid->compactor.start(from, to))
+            return SQUID_BUSY;
+
+        return SQUID_NONE;
+    }
+
+    enum SquidError squid_compact_step(unsigned long long budget)
+    {
+        switch (SquidSnapshot::global_squid->compactor.step(budget)) {
+            case SquidSnapshot::Error::CreateFile:
+                return SQUID_CREATE;
+
+            case SquidSnapshot::Error::WriteFile:
+                return SQUID_WRITE;
+
+            case SquidSnapshot::Error::ReadFile:
+                return SQUID_READ;
+
+            case SquidSnapshot::Error::DeleteFile:
+                return SQUID_DELETE;
+
+            default:
+                return SQUID_NONE;
         }
+    }
+
+    enum SquidError squid_urgent(int enable)
+    {
+        SquidSnapshot::global_squid->io_scheduler.set_urgent(enable != 0);
+        return SQUID_NONE;
+    }
+
+    enum SquidError squid_classify(void* hash, enum SquidClass* cls)
+    {
+        SquidSnapshot::SquidFileHash* squid_file =
+          (SquidSnapshot::SquidFileHash*)hash;
+
+        if (!squid_file->is_valid)
+            return SQUID_INVALID;
+
+        SquidSnapshot::Classifier& classifier =
+          SquidSnapshot::global_squid->classifier;
+
+        switch (classifier.class_of(squid_file->slot())) {
+            case SquidSnapshot::Classifier::COLD:
+                *cls = SQUID_COLD;
+                break;
+
+            case SquidSnapshot::Classifier::HOT:
+                *cls = SQUID_HOT;
+                break;
+
+            case SquidSnapshot::Classifier::WARM:
+                *cls = SQUID_WARM;
+                break;
+        }
+
+        return SQUID_NONE;
+    }
+
+    enum SquidError squid_set_classify(unsigned hot, unsigned cold)
+    {
+        SquidSnapshot::global_squid->classifier.set_config({ hot, cold });
+        return SQUID_NONE;
+    }
+
+    enum SquidError squid_hash_at(void** hash, unsigned long long slot)
+    {
+        if (slot >= SquidSnapshot::HASH_COUNT)
+            return SQUID_FULL;
+
+        SquidSnapshot::SquidFileHash* squid_file =
+          SquidSnapshot::global_squid->root_manager.hash_at(slot);
+        if (squid_file == nullptr)
+            return SQUID_BUSY;
+
+        *hash = (void*)squid_file;
+        return SQUID_NONE;
+    }
+
+    enum SquidError squid_slot(void* hash, unsigned long long* slot)
+    {
+        SquidSnapshot::SquidFileHash* squid_file =
+          (SquidSnapshot::SquidFileHash*)hash;
 
+        if (!squid_file->is_valid)
+            return SQUID_INVALID;
+
+        *slot = squid_file->slot();
         return SQUID_NONE;
     }
 
+    enum SquidError squid_export(char const* target,
+                                 unsigned long long snapshot,
+                                 unsigned long long base)
+    {
+        SquidSnapshot::Backend& backend = SquidSnapshot::squidutils->_backend;
+
+        SquidSnapshot::Stream* stream =
+          backend.open_stream(SquidSnapshot::Path(target), true);
+        if (stream == nullptr)
+            return SQUID_CREATE;
+
+        SquidSnapshot::Error err;
+        {
+            SquidSnapshot::SnapshotStream out(*stream);
+            err = out.write(snapshot, base);
+        }
+
+        backend.close_stream(stream);
+
+        switch (err) {
+            case SquidSnapshot::Error::None:
+                return SQUID_NONE;
+
+            case SquidSnapshot::Error::WriteFile:
+                return SQUID_WRITE;
+
+            case SquidSnapshot::Error::CorruptedFile:
+                return SQUID_CORRUPTED;
+
+            default:
+                return SQUID_READ;
+        }
+    }
+
+    enum SquidError squid_import(char const* source,
+                                 unsigned long long* snapshot)
+    {
+        if (SquidSnapshot::global_squid->compactor.is_running())
+            return SQUID_BUSY;
+
+        SquidSnapshot::Backend& backend = SquidSnapshot::squidutils->_backend;
+
+        SquidSnapshot::Stream* stream =
+          backend.open_stream(SquidSnapshot::Path(source), false);
+        if (stream == nullptr)
+            return SQUID_READ;
+
+        Genode::uint64_t id = 0;
+        SquidSnapshot::Error err;
+        {
+            SquidSnapshot::SnapshotStream in(*stream);
+            err = in.read(id);
+        }
+
+        backend.close_stream(stream);
+
+        switch (err) {
+            case SquidSnapshot::Error::CreateFile:
+                return SQUID_CREATE;
+
+            case SquidSnapshot::Error::WriteFile:
+                return SQUID_WRITE;
+
+            case SquidSnapshot::Error::ReadFile:
+                return SQUID_READ;
+
+            case SquidSnapshot::Error::CorruptedFile:
+                return SQUID_CORRUPTED;
+
+            case SquidSnapshot::Error::InvalidHash:
+                return SQUID_BUSY;
+
+            default:
+                *snapshot = id;
+                return SQUID_NONE;
+        }
+    }
+
     enum SquidError squid_test(void)
     {
         switch (SquidSnapshot::global_squid->test()) {
@@ -0,0 +1,150 @@
+#include "squid.h"
+
+#include <util/string.h>
+
+namespace SquidSnapshot {
+
+    StagingRing::StagingRing(size_t capacity)
+      : capacity(capacity & ~(size_t)15)
+    {
+        buffer =
+          (uint8_t*)SquidSnapshot::squidutils->_heap.alloc(this->capacity);
+
+        stats.capacity = this->capacity;
+    }
+
+    StagingRing::~StagingRing(void)
+    {
+        SquidSnapshot::squidutils->_heap.free(buffer, capacity);
+    }
+
+    StagingRing::Entry* StagingRing::reserve(size_t need)
+    {
+        if (need > capacity)
+            return nullptr;
+
+        if (used == 0) {
+            head = 0;
+            tail = 0;
+        }
+
+        // INFO: Entries are never split. If the payload does not fit before
+        // the end of the buffer, the rest of it is skipped (marked by an
+        // entry without a hash, if there is room for one) and the entry is
+        // placed at offset 0.
+        if (head > tail || used == 0) {
+            if (capacity - head < need) {
+                if (tail < need)
+                    return nullptr;
+
+                if (capacity - head >= sizeof(Entry))
+                    ((Entry*)(buffer + head))->hash = nullptr;
+
+                used += capacity - head;
+                head = 0;
+            }
+        } else if (tail - head < need) {
+            return nullptr;
+        }
+
+        Entry* entry = (Entry*)(buffer + head);
+
+        head += need;
+        used += need;
+
+        if (used > stats.high_water)
+            stats.high_water = used;
+
+        return entry;
+    }
+
+    StagingRing::Entry* StagingRing::front(void)
+    {
+        if (used == 0)
+            return nullptr;
+
+        if (capacity - tail < sizeof(Entry) ||
+            ((Entry*)(buffer + tail))->hash == nullptr) {
+            used -= capacity - tail;
+            tail = 0;
+        }
+
+        return (Entry*)(buffer + tail);
+    }
+
+    Error StagingRing::stage(SquidFileHash* hash,
+                             void const* payload,
+                             size_t size)
+    {
+        if (!hash->is_valid)
+            return Error::InvalidHash;
+
+        Entry* entry = reserve(entry_size(size));
+        if (entry == nullptr) {
+            stats.overflows++;
+            return hash->write((void*)payload, size);
+        }
+
+        entry->hash = hash;
+        entry->generation = hash->generation;
+        entry->size = (uint32_t)size;
+        Genode::memcpy(entry + 1, payload, size);
+
+        hash->staged++;
+
+        stats.entries++;
+        stats.used = used;
+        stats.staged_bytes += size;
+
+        return Error::None;
+    }
+
+    Error StagingRing::drain(size_t budget)
+    {
+        if (is_empty())
+            return Error::None;
+
+        Error result = Error::None;
+        size_t drained = 0;
+
+        uint64_t start = SquidSnapshot::squidutils->_timer.elapsed_us();
+
+        for (Entry* entry = front(); entry != nullptr; entry = front()) {
+            if (budget != 0 && drained >= budget)
+                break;
+
+            SquidFileHash* hash = entry->hash;
+            hash->staged--;
+
+            if (hash->is_valid && hash->generation == entry->generation) {
+                Error err = hash->write_file(entry + 1, entry->size);
+
+                if (err == Error::None) {
+                    stats.drained_bytes += entry->size;
+                } else {
+                    stats.dropped++;
+
+                    if (result == Error::None)
+                        result = err;
+                }
+            } else {
+                // INFO: The hash was deleted after the payload was staged.
+                stats.dropped++;
+            }
+
+            drained += entry->size;
+
+            size_t need = entry_size(entry->size);
+            tail += need;
+            used -= need;
+
+            stats.entries--;
+        }
+
+        stats.used = used;
+        stats.drain_us +=
+          SquidSnapshot::squidutils->_timer.elapsed_us() - start;
+
+        return result;
+    }
+}; // namespace SquidSnapshot
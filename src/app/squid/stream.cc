@@ -0,0 +1,414 @@
+#include "squid.h"
+#include "squidlib.h"
+
+#include <util/string.h>
+
+namespace SquidSnapshot {
+
+    namespace {
+        /* 8 bytes each, including the terminating zero */
+        const char HEADER_MAGIC[] = "SQDSTRM";
+        const char TRAILER_MAGIC[] = "SQDSEND";
+
+        /**
+         * @brief CRC-32C (Castagnoli), reflected.
+         */
+        uint32_t crc_table[256];
+        bool crc_table_ready = false;
+
+        void init_crc_table(void)
+        {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t crc = i;
+
+                for (unsigned bit = 0; bit < 8; bit++)
+                    crc = (crc >> 1) ^ (0x82f63b78 & (0 - (crc & 1)));
+
+                crc_table[i] = crc;
+            }
+
+            crc_table_ready = true;
+        }
+
+        bool is_set(uint8_t const* bitmap, uint64_t slot)
+        {
+            return bitmap[slot / 8] & (1 << (slot % 8));
+        }
+
+        void set(uint8_t* bitmap, uint64_t slot)
+        {
+            bitmap[slot / 8] |= (uint8_t)(1 << (slot % 8));
+        }
+    }
+
+    uint32_t SnapshotStream::checksum(uint32_t crc,
+                                      void const* data,
+                                      size_t size)
+    {
+        if (!crc_table_ready)
+            init_crc_table();
+
+        uint8_t const* bytes = (uint8_t const*)data;
+
+        crc = ~crc;
+        for (size_t i = 0; i < size; i++)
+            crc = crc_table[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+
+        return ~crc;
+    }
+
+    Path SnapshotStream::to_path(void)
+    {
+        Genode::String<1024> path("/", SQUIDROOT, "/import");
+        return path;
+    }
+
+    SnapshotStream::SnapshotStream(Stream& stream)
+      : stream(stream)
+    {
+        Allocator& heap = SquidSnapshot::squidutils->_heap;
+
+        chunk = (uint8_t*)heap.alloc(CHUNK_SIZE);
+        file = (uint8_t*)heap.alloc(MAX_RECORD_SIZE);
+    }
+
+    SnapshotStream::~SnapshotStream(void)
+    {
+        Allocator& heap = SquidSnapshot::squidutils->_heap;
+
+        heap.free(chunk, CHUNK_SIZE);
+        heap.free(file, MAX_RECORD_SIZE);
+    }
+
+    Error SnapshotStream::put(void const* data, size_t size)
+    {
+        crc = checksum(crc, data, size);
+
+        uint8_t const* bytes = (uint8_t const*)data;
+
+        while (size > 0) {
+            if (chunk_used == CHUNK_SIZE) {
+                Error err = flush();
+                if (err != Error::None)
+                    return err;
+            }
+
+            size_t n = CHUNK_SIZE - chunk_used;
+            if (n > size)
+                n = size;
+
+            Genode::memcpy(chunk + chunk_used, bytes, n);
+
+            chunk_used += n;
+            bytes += n;
+            size -= n;
+        }
+
+        return Error::None;
+    }
+
+    Error SnapshotStream::flush(void)
+    {
+        if (chunk_used == 0)
+            return Error::None;
+
+        Error err = stream.write(chunk, chunk_used);
+        chunk_used = 0;
+
+        return err;
+    }
+
+    Error SnapshotStream::get(void* data, size_t size)
+    {
+        uint8_t* bytes = (uint8_t*)data;
+
+        for (size_t left = size; left > 0;) {
+            if (chunk_used == chunk_size) {
+                chunk_used = 0;
+
+                if (stream.read(chunk, CHUNK_SIZE, chunk_size) != Error::None)
+                    return Error::ReadFile;
+
+                // INFO: The stream ended before the trailer.
+                if (chunk_size == 0)
+                    return Error::CorruptedFile;
+            }
+
+            size_t n = chunk_size - chunk_used;
+            if (n > left)
+                n = left;
+
+            Genode::memcpy(bytes, chunk + chunk_used, n);
+
+            chunk_used += n;
+            bytes += n;
+            left -= n;
+        }
+
+        crc = checksum(crc, data, size);
+
+        return Error::None;
+    }
+
+    Error SnapshotStream::write(uint64_t id, uint64_t base)
+    {
+        SnapshotHistory& history = SquidSnapshot::global_squid->history;
+        IoScheduler& io = SquidSnapshot::global_squid->io_scheduler;
+
+        if (!history.contains(id) || base >= id)
+            return Error::ReadFile;
+
+        // INFO: Snapshots compacted into one newer than base are sent again
+        // as a whole, which is redundant but still correct.
+        Manifest manifest{};
+        uint64_t records = 0;
+
+        for (uint64_t slot = 0; slot < HASH_COUNT; slot++) {
+            uint64_t newest = 0;
+            if (!history.newest_with(slot, newest, id))
+                continue;
+
+            set(manifest.live, slot);
+
+            if (newest > base) {
+                set(manifest.carried, slot);
+                records++;
+            }
+        }
+
+        Header header{};
+        Genode::memcpy(header.magic, HEADER_MAGIC, sizeof(header.magic));
+        header.version = VERSION;
+        header.flags = 0;
+        if (base != 0)
+            header.flags |= INCREMENTAL;
+        if (SquidSnapshot::squidutils->encrypted())
+            header.flags |= ENCRYPTED;
+        header.snapshot = id;
+        header.base = base;
+        header.hash_count = HASH_COUNT;
+        header.records = records;
+        header.checksum =
+          checksum(0, &header, __builtin_offsetof(Header, checksum));
+
+        uint32_t manifest_crc = checksum(0, &manifest, sizeof(manifest));
+
+        Error err = put(&header, sizeof(header));
+        if (err == Error::None)
+            err = put(&manifest, sizeof(manifest));
+        if (err == Error::None)
+            err = put(&manifest_crc, sizeof(manifest_crc));
+
+        for (uint64_t slot = 0; err == Error::None && slot < HASH_COUNT;
+             slot++) {
+
+            if (!is_set(manifest.carried, slot))
+                continue;
+
+            uint64_t newest = 0;
+            history.newest_with(slot, newest, id);
+
+            Path snapshot = SnapshotHistory::to_path(newest);
+            Path path = hash_path(snapshot, slot);
+
+            size_t size = 0;
+
+            // INFO: Records of a HotPack are shipped like squid files, the
+            // importing side gets no pack.
+            bool packed = history.is_packed(newest, slot);
+
+            uint64_t start = io.admit(MAX_PAYLOAD_SIZE);
+            err = SquidSnapshot::squidutils->read_file(
+              snapshot, slot, packed, file, MAX_RECORD_SIZE, size);
+            io.complete(start);
+
+            if (err != Error::None)
+                break;
+
+            if (size == MAX_RECORD_SIZE) {
+                Genode::error(SQUID_ERROR_FMT "squid file too large: ", path);
+                err = Error::ReadFile;
+                break;
+            }
+
+            Record record{ slot, (uint32_t)size, checksum(0, file, size) };
+
+            err = put(&record, sizeof(record));
+            if (err == Error::None)
+                err = put(file, size);
+        }
+
+        if (err != Error::None)
+            return err;
+
+        Trailer trailer{};
+        Genode::memcpy(trailer.magic, TRAILER_MAGIC, sizeof(trailer.magic));
+        trailer.records = records;
+        trailer.checksum = crc;
+
+        err = put(&trailer, sizeof(trailer));
+        if (err != Error::None)
+            return err;
+
+        return flush();
+    }
+
+    Error SnapshotStream::read(uint64_t& id)
+    {
+        Main& squid = *SquidSnapshot::global_squid;
+        SnapshotHistory& history = squid.history;
+        IoScheduler& io = squid.io_scheduler;
+        SquidUtils* utils = SquidSnapshot::squidutils;
+
+        Header header{};
+        Error err = get(&header, sizeof(header));
+        if (err != Error::None)
+            return err;
+
+        if (Genode::memcmp(header.magic, HEADER_MAGIC, sizeof(header.magic)) ||
+            header.checksum !=
+              checksum(0, &header, __builtin_offsetof(Header, checksum)))
+            return Error::CorruptedFile;
+
+        if (header.version != VERSION || header.hash_count != HASH_COUNT) {
+            Genode::error(SQUID_ERROR_FMT "incompatible stream, version ",
+                          header.version,
+                          ", ",
+                          header.hash_count,
+                          " hashes");
+            return Error::ReadFile;
+        }
+
+        if (((header.flags & ENCRYPTED) != 0) != utils->encrypted()) {
+            Genode::error(SQUID_ERROR_FMT "stream and squid disagree on "
+                                          "encryption");
+            return Error::ReadFile;
+        }
+
+        // INFO: Lookups expect snapshot ids to grow with time, an import
+        // can thus only extend the history.
+        if (history.size() > 0 &&
+            header.snapshot <= history.at(history.size() - 1)) {
+            Genode::error(SQUID_ERROR_FMT "snapshot ",
+                          header.snapshot,
+                          " is not newer than the local ones");
+            return Error::ReadFile;
+        }
+
+        // INFO: An incremental stream does not carry the hashes unchanged
+        // since its base, they are read from the snapshots below it. These
+        // must thus end with the base, or a newer local snapshot would
+        // shadow them.
+        if ((header.flags & INCREMENTAL) &&
+            (history.size() == 0 ||
+             header.base != history.at(history.size() - 1))) {
+            Genode::error(SQUID_ERROR_FMT "base snapshot ",
+                          header.base,
+                          " is not the newest local one");
+            return Error::ReadFile;
+        }
+
+        Manifest manifest{};
+        uint32_t manifest_crc = 0;
+
+        err = get(&manifest, sizeof(manifest));
+        if (err == Error::None)
+            err = get(&manifest_crc, sizeof(manifest_crc));
+        if (err != Error::None)
+            return err;
+
+        if (manifest_crc != checksum(0, &manifest, sizeof(manifest)))
+            return Error::CorruptedFile;
+
+        // INFO: A hash held here would write over the imported files, and
+        // a deleted one would bury them under its tombstone once
+        // reclaimed. The latter are reclaimed right away.
+        squid.reclaimer.step();
+
+        for (uint64_t slot = 0; slot < HASH_COUNT; slot++) {
+            if (is_set(manifest.live, slot) &&
+                squid.root_manager.is_taken(slot)) {
+                Genode::error(SQUID_ERROR_FMT "slot ",
+                              slot,
+                              " of the stream is in use");
+                return Error::InvalidHash;
+            }
+        }
+
+        // INFO: Leftovers of an interrupted import are cleared first.
+        utils->removetree(to_path());
+        utils->createtree(to_path());
+
+        uint64_t next = 0;
+
+        for (uint64_t i = 0; err == Error::None && i < header.records; i++) {
+            Record record{};
+
+            err = get(&record, sizeof(record));
+            if (err != Error::None)
+                break;
+
+            // INFO: Records come in hash order, once per carried hash.
+            if (record.slot < next || record.slot >= HASH_COUNT ||
+                !is_set(manifest.carried, record.slot) ||
+                record.size >= MAX_RECORD_SIZE) {
+                err = Error::CorruptedFile;
+                break;
+            }
+
+            next = record.slot + 1;
+
+            err = get(file, record.size);
+            if (err != Error::None)
+                break;
+
+            if (record.checksum != checksum(0, file, record.size)) {
+                err = Error::CorruptedFile;
+                break;
+            }
+
+            uint64_t start = io.admit(record.size);
+            err = utils->_storage.write(
+              hash_path(to_path(), record.slot), file, record.size);
+            io.complete(start);
+        }
+
+        if (err == Error::None) {
+            uint32_t expected = crc;
+
+            Trailer trailer{};
+            err = get(&trailer, sizeof(trailer));
+
+            if (err == Error::None &&
+                (Genode::memcmp(
+                   trailer.magic, TRAILER_MAGIC, sizeof(trailer.magic)) ||
+                 trailer.records != header.records ||
+                 trailer.checksum != expected))
+                err = Error::CorruptedFile;
+        }
+
+        if (err == Error::None)
+            err = utils->rename(to_path(),
+                                SnapshotHistory::to_path(header.snapshot));
+
+        if (err != Error::None) {
+            utils->removetree(to_path());
+            return err;
+        }
+
+        if (!history.add(header.snapshot))
+            Genode::error(SQUID_ERROR_FMT "too many snapshots, compact them");
+
+        for (uint64_t slot = 0; slot < HASH_COUNT; slot++) {
+            if (!is_set(manifest.live, slot))
+                continue;
+
+            squid.root_manager.reserve(slot);
+            squid.classifier.note_stored(slot);
+        }
+
+        id = header.snapshot;
+
+        return Error::None;
+    }
+}; // namespace SquidSnapshot
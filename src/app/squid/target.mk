@@ -1,5 +1,5 @@
 TARGET   = squid
-SRC_CC   = main.cc squid.cc benchmark.cc
+SRC_CC   = main.cc squid.cc benchmark.cc crypto.cc staging.cc scheduler.cc history.cc compaction.cc parallel.cc stream.cc reclaim.cc hotcold.cc genode_backend.cc
 LIBS     = vfs_lwext4 base format vfs lwext4
 
 INC_DIR += $(call select_from_ports,lwext4)/include